@@ -0,0 +1,794 @@
+// Benchmarks for edwin. Needs an X server, e.g.
+//   xvfb-run -a ./edwin-bench --out results.json
+// Results are written as JSON, to stdout unless --out is given.
+//   ./edwin-bench --allocations
+// only runs the checks which don't need a display, and fails if they
+// allocate. It's what ctest runs.
+
+#include "edwin.hpp"
+#include "edwin-coro.hpp"
+#include "edwin-ext.hpp"
+#include "edwin-pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <poll.h>
+
+using clock_type = std::chrono::steady_clock;
+
+// Every allocation in the process is counted, to check that edwin's
+// callbacks don't allocate.
+static size_t allocations_ = 0;
+
+auto operator new(size_t size) -> void* {
+	allocations_++;
+	if (const auto ptr = std::malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+
+auto operator delete(void* ptr) noexcept -> void {
+	std::free(ptr);
+}
+
+auto operator delete(void* ptr, size_t) noexcept -> void {
+	std::free(ptr);
+}
+
+static
+auto elapsed_ns(clock_type::time_point beg, clock_type::time_point end) -> double {
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count());
+}
+
+// Collects results as a flat JSON object per benchmark.
+struct json_writer {
+	auto beg(const char* name) -> void {
+		out_ += first_bench_ ? "\n" : ",\n";
+		out_ += "    {\"name\": \"";
+		out_ += name;
+		out_ += "\"";
+		first_bench_ = false;
+	}
+	auto field(const char* key, double value) -> void {
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%.1f", value);
+		out_ += ", \"";
+		out_ += key;
+		out_ += "\": ";
+		out_ += buf;
+	}
+	auto end() -> void {
+		out_ += "}";
+	}
+	auto finish() -> std::string {
+		return "{\n  \"benchmarks\": [" + out_ + "\n  ]\n}\n";
+	}
+private:
+	std::string out_;
+	bool first_bench_ = true;
+};
+
+// Percentiles etc. of a set of samples, in nanoseconds.
+static
+auto write_distribution(json_writer* json, const char* prefix, std::vector<double> samples) -> void {
+	if (samples.empty()) {
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	auto at = [&samples](double p) { return samples[std::min(samples.size() - 1, size_t(p * samples.size()))]; };
+	const auto key = [prefix](const char* suffix) { return std::string{prefix} + suffix; };
+	json->field(key("_p50_ns").c_str(), at(0.50));
+	json->field(key("_p99_ns").c_str(), at(0.99));
+	json->field(key("_max_ns").c_str(), samples.back());
+}
+
+static
+auto send_configure_notify(Display* xdisplay, Window xwindow, edwin::size size) -> void {
+	XEvent event = {};
+	event.xconfigure.type    = ConfigureNotify;
+	event.xconfigure.display = xdisplay;
+	event.xconfigure.event   = xwindow;
+	event.xconfigure.window  = xwindow;
+	event.xconfigure.width   = size.width;
+	event.xconfigure.height  = size.height;
+	// An empty event mask sends the event to the client that created the
+	// window, i.e. edwin's own connection.
+	XSendEvent(xdisplay, xwindow, False, NoEventMask, &event);
+}
+
+static
+auto send_destroy_notify(Display* xdisplay, Window xwindow) -> void {
+	XEvent event = {};
+	event.xdestroywindow.type    = DestroyNotify;
+	event.xdestroywindow.display = xdisplay;
+	event.xdestroywindow.event   = xwindow;
+	event.xdestroywindow.window  = xwindow;
+	XSendEvent(xdisplay, xwindow, False, NoEventMask, &event);
+}
+
+static
+auto make_config() -> edwin::window_config {
+	auto cfg = edwin::window_config{};
+	cfg.size = {100, 100};
+	cfg.title = {"edwin-bench"};
+	return cfg;
+}
+
+// Window table scaling: create N windows, dispatch one event to each,
+// destroy them in random order.
+static
+auto bench_window_table(json_writer* json, Display* xdisplay, int count) -> void {
+	auto windows = std::vector<edwin::window*>{};
+	auto callbacks = 0;
+	windows.reserve(count);
+	const auto create_beg = clock_type::now();
+	for (auto i = 0; i < count; i++) {
+		auto cfg = make_config();
+		cfg.on_resizing.fn = [&callbacks](edwin::size) { callbacks++; };
+		windows.push_back(edwin::create(std::move(cfg)));
+	}
+	const auto create_end = clock_type::now();
+	for (auto it = windows.rbegin(); it != windows.rend(); it++) {
+		send_configure_notify(xdisplay, edwin::get_xwindow(**it), {200, 200});
+	}
+	XSync(xdisplay, False);
+	const auto dispatch_beg = clock_type::now();
+	while (callbacks < count) {
+		edwin::process_messages();
+	}
+	const auto dispatch_end = clock_type::now();
+	std::shuffle(windows.begin(), windows.end(), std::mt19937{12345});
+	const auto destroy_beg = clock_type::now();
+	for (const auto wnd : windows) {
+		edwin::destroy(wnd);
+	}
+	const auto destroy_end = clock_type::now();
+	edwin::process_messages();
+	json->beg("window_table");
+	json->field("windows", count);
+	json->field("create_ns_per_window", elapsed_ns(create_beg, create_end) / count);
+	json->field("dispatch_ns_per_event", elapsed_ns(dispatch_beg, dispatch_end) / count);
+	json->field("destroy_ns_per_window", elapsed_ns(destroy_beg, destroy_end) / count);
+	json->end();
+}
+
+// Create/destroy cycles of a single window.
+static
+auto bench_create_destroy(json_writer* json, int count) -> void {
+	const auto beg = clock_type::now();
+	for (auto i = 0; i < count; i++) {
+		edwin::destroy(edwin::create(make_config()));
+	}
+	edwin::process_messages();
+	const auto end = clock_type::now();
+	json->beg("create_destroy");
+	json->field("cycles", count);
+	json->field("ns_per_cycle", elapsed_ns(beg, end) / count);
+	json->field("cycles_per_second", count / (elapsed_ns(beg, end) / 1e9));
+	json->end();
+}
+
+// Opening a session's worth of windows with create() one at a time and
+// with one create_many(), timed through the trace sink the way an
+// application would track it.
+static
+auto bench_create_many(json_writer* json, int count) -> void {
+	auto traced_ns = 0.0;
+	edwin::set_trace_sink({.end = [&traced_ns](edwin::trace_scope scope, const edwin::window*, std::chrono::nanoseconds elapsed) {
+		if (scope == edwin::trace_scope::create) {
+			traced_ns += double(elapsed.count());
+		}
+	}});
+	const auto open_windows = [count, &traced_ns](bool together) -> std::pair<double, double> {
+		auto cfgs = std::vector<edwin::window_config>(count);
+		for (auto& cfg : cfgs) {
+			cfg = make_config();
+			cfg.visible = edwin::show;
+		}
+		auto windows = std::vector<edwin::window*>{};
+		traced_ns = 0.0;
+		const auto beg = clock_type::now();
+		if (together) {
+			windows = edwin::create_many(cfgs);
+		}
+		else {
+			for (auto& cfg : cfgs) {
+				windows.push_back(edwin::create(std::move(cfg)));
+			}
+		}
+		edwin::process_messages();
+		const auto end = clock_type::now();
+		for (const auto wnd : windows) {
+			edwin::destroy(wnd);
+		}
+		edwin::process_messages();
+		return {elapsed_ns(beg, end), traced_ns};
+	};
+	const auto [one_by_one_ns, one_by_one_traced_ns] = open_windows(false);
+	const auto [together_ns, together_traced_ns] = open_windows(true);
+	edwin::set_trace_sink({});
+	json->beg("create_many");
+	json->field("windows", count);
+	json->field("create_ns", one_by_one_ns);
+	json->field("create_traced_ns", one_by_one_traced_ns);
+	json->field("create_many_ns", together_ns);
+	json->field("create_many_traced_ns", together_traced_ns);
+	json->end();
+}
+
+// Acquire/release cycles of a pooled window, to compare with create_destroy.
+static
+auto bench_pool(json_writer* json, int count) -> void {
+	auto pool = edwin::pool{{.capacity = 1, .size = {100, 100}}};
+	edwin::process_messages();
+	const auto beg = clock_type::now();
+	for (auto i = 0; i < count; i++) {
+		auto cfg = make_config();
+		cfg.visible = edwin::show;
+		pool.release(pool.acquire(std::move(cfg)));
+	}
+	edwin::process_messages();
+	const auto end = clock_type::now();
+	json->beg("pool_acquire_release");
+	json->field("cycles", count);
+	json->field("ns_per_cycle", elapsed_ns(beg, end) / count);
+	json->field("cycles_per_second", count / (elapsed_ns(beg, end) / 1e9));
+	json->end();
+}
+
+// Time from injecting a ConfigureNotify on another connection until
+// on_resizing is called.
+static
+auto bench_configure_latency(json_writer* json, Display* xdisplay, int count) -> void {
+	auto called = false;
+	auto cfg = make_config();
+	cfg.on_resizing.fn = [&called](edwin::size) { called = true; };
+	const auto wnd = edwin::create(std::move(cfg));
+	const auto xwindow = edwin::get_xwindow(*wnd);
+	edwin::process_messages();
+	auto samples = std::vector<double>{};
+	for (auto i = 0; i < count; i++) {
+		called = false;
+		const auto beg = clock_type::now();
+		// Alternate the size, or the event would be dropped as a no-op.
+		send_configure_notify(xdisplay, xwindow, {200 + (i % 2), 200});
+		XFlush(xdisplay);
+		while (!called) {
+			edwin::process_messages();
+		}
+		samples.push_back(elapsed_ns(beg, clock_type::now()));
+	}
+	edwin::destroy(wnd);
+	json->beg("configure_latency");
+	json->field("events", count);
+	write_distribution(json, "latency", samples);
+	json->end();
+}
+
+// Time from injecting a DestroyNotify until on_closed is called.
+static
+auto bench_destroy_latency(json_writer* json, Display* xdisplay, int count) -> void {
+	auto samples = std::vector<double>{};
+	for (auto i = 0; i < count; i++) {
+		auto closed = false;
+		auto cfg = make_config();
+		cfg.on_closed.fn = [&closed] { closed = true; };
+		const auto wnd = edwin::create(std::move(cfg));
+		edwin::process_messages();
+		const auto beg = clock_type::now();
+		send_destroy_notify(xdisplay, edwin::get_xwindow(*wnd));
+		XFlush(xdisplay);
+		while (!closed) {
+			edwin::process_messages();
+		}
+		samples.push_back(elapsed_ns(beg, clock_type::now()));
+	}
+	json->beg("destroy_latency");
+	json->field("events", count);
+	write_distribution(json, "latency", samples);
+	json->end();
+}
+
+// Client side cost of the setters, including flushing the requests to the
+// server. edwin's connection isn't exposed, so there's no way to wait for
+// the server to process them.
+template <typename SetFn>
+static
+auto bench_setter(json_writer* json, const char* name, int count, SetFn set_fn) -> void {
+	const auto wnd = edwin::create(make_config());
+	edwin::process_messages();
+	const auto beg = clock_type::now();
+	for (auto i = 0; i < count; i++) {
+		set_fn(wnd, i);
+	}
+	// XPending() flushes the output buffer.
+	edwin::process_messages();
+	const auto end = clock_type::now();
+	edwin::destroy(wnd);
+	edwin::process_messages();
+	json->beg(name);
+	json->field("calls", count);
+	json->field("ns_per_call", elapsed_ns(beg, end) / count);
+	json->end();
+}
+
+static
+auto bench_setters(json_writer* json, int count) -> void {
+	static auto pixels = std::vector<edwin::rgba>(64 * 64, edwin::rgba{std::byte{255}, std::byte{0}, std::byte{0}, std::byte{255}});
+	bench_setter(json, "set_position", count, [](edwin::window* wnd, int i) { edwin::set(wnd, edwin::position{i % 100, i % 100}); });
+	bench_setter(json, "set_size", count, [](edwin::window* wnd, int i) { edwin::set(wnd, edwin::size{100 + i % 100, 100}); });
+	bench_setter(json, "set_title", count, [](edwin::window* wnd, int i) { edwin::set(wnd, edwin::title{(i % 2) ? "odd" : "even"}); });
+	bench_setter(json, "set_resizable", count, [](edwin::window* wnd, int i) { edwin::set(wnd, edwin::resizable{(i % 2) == 0}); });
+	bench_setter(json, "set_icon", count, [](edwin::window* wnd, int) { edwin::set(wnd, edwin::icon{{64, 64}, pixels}); });
+	bench_setter(json, "batch", count, [](edwin::window* wnd, int i) {
+		auto b = edwin::batch{wnd};
+		b.set(edwin::position{i % 100, i % 100}, edwin::size{100 + i % 100, 100});
+		b.set(edwin::resizable{true});
+		b.set(edwin::title{"batch"});
+		b.commit();
+	});
+}
+
+static
+auto send_motion_notify(Display* xdisplay, Window xwindow, edwin::position position) -> void {
+	XEvent event = {};
+	event.xmotion.type    = MotionNotify;
+	event.xmotion.display = xdisplay;
+	event.xmotion.window  = xwindow;
+	event.xmotion.x       = position.x;
+	event.xmotion.y       = position.y;
+	XSendEvent(xdisplay, xwindow, False, NoEventMask, &event);
+}
+
+// A burst of mouse moves, with and without motion compression.
+static
+auto bench_motion_storm(json_writer* json, Display* xdisplay, int count, bool compress) -> void {
+	auto callbacks = 0;
+	auto last = edwin::position{};
+	auto cfg = make_config();
+	cfg.compress_motion = {compress};
+	cfg.on_mouse_move.fn = [&](const edwin::mouse_move_event& e) { callbacks++; last = e.position; };
+	const auto wnd = edwin::create(std::move(cfg));
+	const auto xwindow = edwin::get_xwindow(*wnd);
+	edwin::process_messages();
+	for (auto i = 1; i <= count; i++) {
+		send_motion_notify(xdisplay, xwindow, {i % 100, i});
+	}
+	XSync(xdisplay, False);
+	const auto beg = clock_type::now();
+	while (last.y != count) {
+		edwin::process_messages();
+	}
+	const auto end = clock_type::now();
+	edwin::destroy(wnd);
+	json->beg(compress ? "motion_storm_compressed" : "motion_storm");
+	json->field("events", count);
+	json->field("callbacks", callbacks);
+	json->field("ns_per_event", elapsed_ns(beg, end) / count);
+	json->end();
+}
+
+// Dispatch cost measured by replaying a recording, so that it doesn't
+// depend on how fast the X server can deliver the events.
+static
+auto bench_replay(json_writer* json, Display* xdisplay, int count) -> void {
+	const auto path = "edwin-bench-replay.bin";
+	auto moves = 0;
+	auto resizes = 0;
+	auto cfg = make_config();
+	cfg.compress_motion = {false};
+	cfg.on_mouse_move.fn = [&moves](const edwin::mouse_move_event&) { moves++; };
+	cfg.on_resizing.fn   = [&resizes](edwin::size) { resizes++; };
+	const auto wnd = edwin::create(std::move(cfg));
+	const auto xwindow = edwin::get_xwindow(*wnd);
+	edwin::process_messages();
+	if (!edwin::record_events(path)) {
+		edwin::destroy(wnd);
+		return;
+	}
+	auto events = 0;
+	for (auto i = 1; i <= count; i++) {
+		send_motion_notify(xdisplay, xwindow, {i % 100, i});
+		events++;
+		if (i % 10 == 0) {
+			send_configure_notify(xdisplay, xwindow, {200 + i % 100, 200});
+			events++;
+		}
+	}
+	XSync(xdisplay, False);
+	while (moves < count) {
+		edwin::process_messages();
+	}
+	edwin::stop_recording();
+	const auto live_resizes = resizes;
+	moves   = 0;
+	resizes = 0;
+	const auto beg = clock_type::now();
+	const auto replayed = edwin::replay_events(path);
+	const auto end = clock_type::now();
+	edwin::destroy(wnd);
+	std::remove(path);
+	json->beg("replay");
+	json->field("events", events);
+	json->field("replayed", replayed ? 1 : 0);
+	json->field("callbacks", moves + resizes);
+	json->field("live_callbacks", count + live_resizes);
+	json->field("ns_per_event", elapsed_ns(beg, end) / events);
+	json->end();
+}
+
+static
+auto count_resumes(int* resumes) -> edwin::task {
+	(*resumes)++;
+	co_return;
+}
+
+// Storing callbacks the way set() does, moving them out to call them the
+// way dispatch does, and running tasks, none of which needs a display.
+// Once warm none of it should allocate. Returns false if any of it did.
+static
+auto check_allocations(json_writer* json, int count) -> bool {
+	auto calls = 0;
+	auto resumes = 0;
+	auto stored = edwin::fn::on_window_resized{};
+	const auto cycle = [&calls, &resumes, &stored](int i) {
+		// As big as fits inline.
+		const auto a = &calls;
+		const auto b = &resumes;
+		stored = {[&calls, a, b, i](edwin::size size) { calls += size.width + i + (a == b); }};
+		auto fn = std::move(stored.fn);
+		fn({1, 1});
+		stored.fn = std::move(fn);
+		count_resumes(&resumes);
+	};
+	// The first task warms up the coroutine frame arena.
+	cycle(0);
+	const auto beg = allocations_;
+	for (auto i = 0; i < count; i++) {
+		cycle(i);
+	}
+	const auto allocated = allocations_ - beg;
+	json->beg("allocations_without_display");
+	json->field("cycles", count);
+	json->field("calls", calls);
+	json->field("resumes", resumes);
+	json->field("allocations", double(allocated));
+	json->end();
+	return allocated == 0 && resumes == count + 1;
+}
+
+// Allocations caused by storing and invoking callbacks. Creating a window
+// allocates for the window table, but that should be the same with or
+// without callbacks, and once warm setting callbacks and dispatching to
+// them shouldn't allocate at all. Returns false if the callbacks
+// allocated.
+static
+auto bench_allocations(json_writer* json, Display* xdisplay) -> bool {
+	auto resized = 0;
+	const auto make_callbacks_config = [&resized] {
+		auto cfg = make_config();
+		cfg.on_closed.fn   = [&resized] { resized = -1; };
+		cfg.on_resized.fn  = [&resized](edwin::size) { resized++; };
+		cfg.on_resizing.fn = [&resized](edwin::size) { resized++; };
+		return cfg;
+	};
+	const auto count_create = [](edwin::window_config cfg) {
+		const auto beg = allocations_;
+		const auto wnd = edwin::create(std::move(cfg));
+		const auto count = allocations_ - beg;
+		edwin::destroy(wnd);
+		edwin::process_messages();
+		return count;
+	};
+	// Warm up the window table and Xlib's buffers.
+	for (auto i = 0; i < 4; i++) {
+		count_create(make_callbacks_config());
+	}
+	const auto without_callbacks = count_create(make_config());
+	const auto with_callbacks    = count_create(make_callbacks_config());
+	const auto wnd = edwin::create(make_callbacks_config());
+	const auto xwindow = edwin::get_xwindow(*wnd);
+	edwin::process_messages();
+	const auto sets_beg = allocations_;
+	for (auto i = 0; i < 1000; i++) {
+		edwin::set(wnd, edwin::fn::on_window_resizing{[&resized](edwin::size) { resized++; }});
+	}
+	const auto sets = allocations_ - sets_beg;
+	auto dispatch = size_t{0};
+	for (auto i = 0; i < 2; i++) {
+		// The first pass warms up Xlib's event queue.
+		const auto target = resized + 1;
+		send_configure_notify(xdisplay, xwindow, {300 + i, 300});
+		XSync(xdisplay, False);
+		const auto beg = allocations_;
+		while (resized < target) {
+			edwin::process_messages();
+		}
+		dispatch = allocations_ - beg;
+	}
+	edwin::destroy(wnd);
+	edwin::process_messages();
+	json->beg("allocations");
+	json->field("create_without_callbacks", double(without_callbacks));
+	json->field("create_with_callbacks", double(with_callbacks));
+	json->field("dispatch_to_callback", double(dispatch));
+	json->field("set_callback", double(sets));
+	json->end();
+	return with_callbacks == without_callbacks && sets == 0 && dispatch == 0;
+}
+
+// Presenting a software rendered surface, the whole window and a small
+// dirty rect.
+static
+auto bench_surface(json_writer* json, int count) -> void {
+	auto cfg = make_config();
+	cfg.size = {800, 600};
+	cfg.visible = edwin::show;
+	const auto wnd = edwin::create(std::move(cfg));
+	const auto surf = edwin::create_surface(wnd);
+	if (!surf) {
+		edwin::destroy(wnd);
+		return;
+	}
+	const auto run = [surf, count](std::span<const edwin::rect> dirty) {
+		const auto beg = clock_type::now();
+		for (auto i = 0; i < count; i++) {
+			const auto pixels = edwin::acquire(surf);
+			std::fill(pixels.begin(), pixels.end(), edwin::rgba{std::byte(i), std::byte{0}, std::byte{0}, std::byte{255}});
+			edwin::present(surf, dirty);
+		}
+		return elapsed_ns(beg, clock_type::now()) / count;
+	};
+	const auto small = edwin::rect{10, 10, 64, 64};
+	json->beg("surface_present");
+	json->field("width", 800);
+	json->field("height", 600);
+	json->field("full_ns_per_frame", run({}));
+	json->field("dirty_64x64_ns_per_frame", run({&small, 1}));
+	json->end();
+	edwin::destroy(surf);
+	edwin::destroy(wnd);
+}
+
+// A burst of ConfigureNotify events for one window, like an interactive
+// resize produces, should cost one callback per dispatch pass.
+static
+auto bench_resize_storm(json_writer* json, Display* xdisplay, int count) -> void {
+	auto callbacks = 0;
+	auto last_size = edwin::size{};
+	auto cfg = make_config();
+	cfg.on_resizing.fn = [&](edwin::size size) { callbacks++; last_size = size; };
+	const auto wnd = edwin::create(std::move(cfg));
+	const auto xwindow = edwin::get_xwindow(*wnd);
+	edwin::process_messages();
+	for (auto i = 1; i <= count; i++) {
+		send_configure_notify(xdisplay, xwindow, {100 + i, 100 + i});
+	}
+	XSync(xdisplay, False);
+	const auto beg = clock_type::now();
+	auto passes = 0;
+	while (last_size.width != 100 + count) {
+		edwin::process_messages();
+		passes++;
+	}
+	const auto end = clock_type::now();
+	edwin::destroy(wnd);
+	json->beg("resize_storm");
+	json->field("events", count);
+	json->field("callbacks", callbacks);
+	json->field("dispatch_passes", passes);
+	json->field("total_ns", elapsed_ns(beg, end));
+	json->field("ns_per_event", elapsed_ns(beg, end) / count);
+	json->end();
+}
+
+// How accurately app_beg() hits its frame deadlines when idle.
+static
+auto bench_frame_pacing(json_writer* json, std::chrono::milliseconds interval, int count) -> void {
+	auto times = std::vector<clock_type::time_point>{};
+	times.reserve(count);
+	auto frame = edwin::fn::frame{[&times, count] {
+		times.push_back(clock_type::now());
+		if (int(times.size()) >= count) {
+			edwin::app_end();
+		}
+	}};
+	edwin::app_beg(std::move(frame), {interval});
+	auto errors = std::vector<double>{};
+	for (size_t i = 1; i < times.size(); i++) {
+		const auto gap = elapsed_ns(times[i - 1], times[i]);
+		errors.push_back(std::abs(gap - std::chrono::duration<double, std::nano>(interval).count()));
+	}
+	const auto stats = edwin::get_frame_stats();
+	json->beg("frame_pacing");
+	json->field("interval_ns", std::chrono::duration<double, std::nano>(interval).count());
+	json->field("frames", double(stats.frames));
+	json->field("missed", double(stats.missed));
+	json->field("jitter_mean_ns", double(stats.jitter_mean.count()));
+	json->field("jitter_max_ns", double(stats.jitter_max.count()));
+	write_distribution(json, "gap_error", errors);
+	json->end();
+}
+
+// Per-window frames at two different rates next to the app_beg() frames,
+// which only stop the loop once enough time has passed.
+static
+auto bench_window_frames(json_writer* json, std::chrono::milliseconds fast, std::chrono::milliseconds slow, std::chrono::milliseconds duration) -> void {
+	auto fast_frames = 0;
+	auto slow_frames = 0;
+	auto fast_cfg = make_config();
+	auto slow_cfg = make_config();
+	const auto fast_wnd = edwin::create(std::move(fast_cfg));
+	const auto slow_wnd = edwin::create(std::move(slow_cfg));
+	edwin::set(fast_wnd, edwin::fn::frame{[&fast_frames] { fast_frames++; }}, {fast});
+	edwin::set(slow_wnd, edwin::fn::frame{[&slow_frames] { slow_frames++; }}, {slow});
+	const auto beg = clock_type::now();
+	auto app_frames = 0;
+	edwin::app_beg(edwin::fn::frame{[&app_frames, beg, duration] {
+		app_frames++;
+		if (clock_type::now() - beg >= duration) {
+			edwin::app_end();
+		}
+	}}, {duration / 10});
+	const auto elapsed = elapsed_ns(beg, clock_type::now());
+	edwin::destroy(fast_wnd);
+	edwin::destroy(slow_wnd);
+	edwin::process_messages();
+	const auto expected = [elapsed](std::chrono::milliseconds interval) { return elapsed / std::chrono::duration<double, std::nano>(interval).count(); };
+	json->beg("window_frames");
+	json->field("elapsed_ns", elapsed);
+	json->field("app_frames", app_frames);
+	json->field("fast_frames", fast_frames);
+	json->field("fast_expected", expected(fast));
+	json->field("slow_frames", slow_frames);
+	json->field("slow_expected", expected(slow));
+	json->end();
+}
+
+// A host event loop which polls edwin's fds and deadline instead of
+// calling app_beg(). Every wakeup should have had something to do.
+static
+auto bench_external_loop(json_writer* json, std::chrono::milliseconds interval, int count) -> void {
+	auto frames = 0;
+	edwin::app_attach({[&frames, count] {
+		if (++frames >= count) {
+			edwin::app_end();
+		}
+	}}, {interval});
+	auto wakeups = 0;
+	auto fds = std::vector<pollfd>{};
+	for (const auto fd : edwin::poll_fds()) {
+		fds.push_back({fd, POLLIN, 0});
+	}
+	const auto beg = clock_type::now();
+	while (frames < count) {
+		const auto deadline = edwin::next_deadline();
+		const auto timeout = deadline == clock_type::time_point::max() ? -1
+			: std::max<int>(0, int(std::chrono::ceil<std::chrono::milliseconds>(deadline - clock_type::now()).count()));
+		poll(fds.data(), fds.size(), timeout);
+		edwin::dispatch_ready();
+		wakeups++;
+	}
+	const auto end = clock_type::now();
+	edwin::dispatch_ready();
+	const auto stats = edwin::get_frame_stats();
+	json->beg("external_loop");
+	json->field("interval_ns", std::chrono::duration<double, std::nano>(interval).count());
+	json->field("frames", frames);
+	json->field("wakeups", wakeups);
+	json->field("missed", double(stats.missed));
+	json->field("jitter_mean_ns", double(stats.jitter_mean.count()));
+	json->field("ns_per_frame", elapsed_ns(beg, end) / count);
+	json->end();
+}
+
+static
+auto wait_frames(int frames, int* resumes) -> edwin::task {
+	for (auto i = 0; i < frames; i++) {
+		co_await edwin::next_frame();
+		(*resumes)++;
+	}
+}
+
+// Coroutines waiting on next_frame(), resumed by app_beg()'s loop. Once
+// the first batch has warmed up the frame arena, starting more tasks
+// shouldn't allocate.
+static
+auto bench_coroutines(json_writer* json, int tasks, int frames) -> void {
+	auto resumes = 0;
+	for (auto i = 0; i < tasks; i++) {
+		wait_frames(1, &resumes);
+	}
+	edwin::app_beg({[] { edwin::app_end(); }}, {std::chrono::milliseconds{0}});
+	resumes = 0;
+	const auto allocations = allocations_;
+	for (auto i = 0; i < tasks; i++) {
+		wait_frames(frames, &resumes);
+	}
+	const auto task_allocations = allocations_ - allocations;
+	auto count = 0;
+	const auto beg = clock_type::now();
+	edwin::app_beg({[&count, frames] { if (++count > frames) { edwin::app_end(); } }}, {std::chrono::milliseconds{0}});
+	const auto end = clock_type::now();
+	json->beg("coroutines");
+	json->field("tasks", tasks);
+	json->field("frames", frames);
+	json->field("resumes", resumes);
+	json->field("task_allocations", double(task_allocations));
+	json->field("ns_per_resume", elapsed_ns(beg, end) / std::max(resumes, 1));
+	json->end();
+}
+
+auto main(int argc, char** argv) -> int {
+	const char* out_path = nullptr;
+	auto allocations_only = false;
+	for (auto i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			out_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--allocations") == 0) {
+			allocations_only = true;
+		}
+	}
+	auto json = json_writer{};
+	const auto no_display_allocation_free = check_allocations(&json, 1000);
+	if (!no_display_allocation_free) {
+		std::fprintf(stderr, "Storing or calling callbacks allocated once warm.\n");
+	}
+	if (allocations_only) {
+		std::fputs(json.finish().c_str(), stdout);
+		return no_display_allocation_free ? 0 : 1;
+	}
+	// A second connection to inject events, the way a window manager would.
+	const auto xdisplay = XOpenDisplay(nullptr);
+	if (!xdisplay) {
+		std::fprintf(stderr, "Failed to open X display.\n");
+		return 1;
+	}
+	const auto callbacks_allocation_free = bench_allocations(&json, xdisplay) && no_display_allocation_free;
+	if (!callbacks_allocation_free) {
+		std::fprintf(stderr, "Callbacks allocated, see the allocations results.\n");
+	}
+	for (const auto count : {1000, 2500, 5000, 10000}) {
+		bench_window_table(&json, xdisplay, count);
+	}
+	bench_create_destroy(&json, 1000);
+	bench_create_many(&json, 64);
+	bench_pool(&json, 1000);
+	bench_configure_latency(&json, xdisplay, 1000);
+	bench_destroy_latency(&json, xdisplay, 200);
+	bench_setters(&json, 1000);
+	bench_surface(&json, 200);
+	bench_resize_storm(&json, xdisplay, 10000);
+	bench_motion_storm(&json, xdisplay, 10000, false);
+	bench_motion_storm(&json, xdisplay, 10000, true);
+	bench_replay(&json, xdisplay, 10000);
+	bench_frame_pacing(&json, std::chrono::milliseconds{10}, 200);
+	bench_window_frames(&json, std::chrono::milliseconds{16}, std::chrono::milliseconds{100}, std::chrono::milliseconds{1000});
+	bench_coroutines(&json, 1000, 100);
+	bench_external_loop(&json, std::chrono::milliseconds{10}, 100);
+	XCloseDisplay(xdisplay);
+	const auto text = json.finish();
+	const auto result = callbacks_allocation_free ? 0 : 1;
+	if (!out_path) {
+		std::fputs(text.c_str(), stdout);
+		return result;
+	}
+	const auto file = std::fopen(out_path, "w");
+	if (!file) {
+		std::fprintf(stderr, "Failed to open %s.\n", out_path);
+		return 1;
+	}
+	std::fputs(text.c_str(), file);
+	std::fclose(file);
+	return result;
+}
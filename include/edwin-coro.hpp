@@ -0,0 +1,89 @@
+#pragma once
+
+// Coroutines which wait for edwin's loop instead of polling it every frame:
+//
+//   auto animate(edwin::window* wnd) -> edwin::task {
+//       for (;;) {
+//           const auto size = co_await edwin::resized(wnd);
+//           if (!size) { co_return; } // The window is gone.
+//           while (!layout_done(*size)) {
+//               co_await edwin::next_frame();
+//           }
+//       }
+//   }
+//
+// Waiting coroutines are resumed from inside edwin's dispatch, on the main
+// thread: next_frame() by the loop started with app_beg(), just after the
+// frame callback, and resized() just after on_resized. closed() resumes
+// once the window has been destroyed, which on Windows and Linux happens
+// by itself just after on_closed, and after which the window mustn't be
+// used again. A coroutine which is waiting for something costs nothing
+// until it happens.
+//
+// Coroutine frames come from an arena which keeps freed frames for reuse,
+// so once a few tasks of a given kind have run, starting another one
+// doesn't allocate.
+
+#include "edwin.hpp"
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+
+namespace edwin {
+
+[[nodiscard]] auto alloc_coro_frame(size_t size) -> void*;
+              auto free_coro_frame(void* ptr, size_t size) -> void;
+
+// These register a coroutine to be resumed, and are what the awaitables
+// below are made of. The window ones return false without registering
+// anything if the window has already been destroyed, in which case the
+// coroutine carries on straight away.
+              auto await_frame(std::coroutine_handle<> coro) -> void;
+              auto await_resized(window* wnd, std::coroutine_handle<> coro, std::optional<edwin::size>* result) -> bool;
+              auto await_closed(window* wnd, std::coroutine_handle<> coro) -> bool;
+
+// A coroutine which starts running straight away and cleans up after
+// itself when it finishes. There's nothing to wait on or cancel, so tasks
+// which can outlive something should also co_await closed() or check the
+// result of resized().
+struct task {
+	struct promise_type {
+		auto get_return_object() -> task             { return {}; }
+		auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+		auto final_suspend() noexcept -> std::suspend_never   { return {}; }
+		auto return_void() -> void                   {}
+		auto unhandled_exception() -> void           { std::terminate(); }
+		static auto operator new(size_t size) -> void*            { return alloc_coro_frame(size); }
+		static auto operator delete(void* ptr, size_t size) -> void { free_coro_frame(ptr, size); }
+	};
+};
+
+struct frame_awaiter {
+	auto await_ready() const noexcept -> bool                 { return false; }
+	auto await_suspend(std::coroutine_handle<> coro) -> void { await_frame(coro); }
+	auto await_resume() const noexcept -> void                {}
+};
+
+// Results in the window's new size, or nothing if the window was
+// destroyed first.
+struct resized_awaiter {
+	window* wnd = nullptr;
+	std::optional<edwin::size> result = {};
+	auto await_ready() const noexcept -> bool                 { return !wnd; }
+	auto await_suspend(std::coroutine_handle<> coro) -> bool { return await_resized(wnd, coro, &result); }
+	auto await_resume() const noexcept -> std::optional<edwin::size> { return result; }
+};
+
+struct closed_awaiter {
+	window* wnd;
+	auto await_ready() const noexcept -> bool                 { return !wnd; }
+	auto await_suspend(std::coroutine_handle<> coro) -> bool { return await_closed(wnd, coro); }
+	auto await_resume() const noexcept -> void                {}
+};
+
+[[nodiscard]] inline auto next_frame() -> frame_awaiter             { return {}; }
+[[nodiscard]] inline auto resized(window* wnd) -> resized_awaiter   { return {wnd}; }
+[[nodiscard]] inline auto closed(window* wnd) -> closed_awaiter     { return {wnd}; }
+
+} // edwin
@@ -18,12 +18,98 @@ namespace edwin {
 
 #if defined(__linux__) /////////////////////////////////////////////////////
 
+#include <chrono>
+#include <cstdint>
+#include <span>
 #include <X11/Xlib.h>
+#if defined(EDWIN_XCB)
+#include <xcb/xcb.h>
+#endif
 
 namespace edwin {
 
 [[nodiscard]] auto get_xwindow(const window& w) -> Window;
 
+// Sharing the connection with a host (e.g. a plugin host which already
+// has one) instead of edwin opening its own. This has to happen before
+// edwin connects, i.e. before the first window is created, and edwin
+// never closes the connection.
+//
+// The host's event loop stays in charge of the queue. Any event it reads
+// should be passed to dispatch(), which returns false if it wasn't meant
+// for edwin. process_messages() still has to be called to run posted
+// tasks and deliver coalesced resize and motion events. It never reads
+// from a shared connection, so it can't take events the host is polling
+// for. With Xlib it does handle edwin's events which are already sitting
+// in the queue, leaving the host's ones where they were.
+#if defined(EDWIN_XCB)
+              auto set_xcb_connection(xcb_connection_t* xcb, int screen_index) -> void;
+[[nodiscard]] auto get_xcb_connection() -> xcb_connection_t*;
+              auto dispatch(const xcb_generic_event_t& event) -> bool;
+#else
+              auto set_xdisplay(Display* xdisplay) -> void;
+[[nodiscard]] auto get_xdisplay() -> Display*;
+              auto dispatch(const XEvent& event) -> bool;
+#endif
+
+// Running edwin inside another event loop (epoll, libuv, ...) instead of
+// calling app_beg(), or calling process_messages() on a timer. Wait until
+// one of poll_fds() is readable or next_deadline() has passed, then call
+// dispatch_ready(), which only reads from the connection if there's
+// something to read. poll_fds() are the X connection and the fd which
+// post() writes to, and don't change once edwin has connected.
+// app_attach() runs frames like app_beg() would, from dispatch_ready(),
+// without blocking. app_end() stops them again.
+[[nodiscard]] auto poll_fds() -> std::span<const int>;
+              // time_point::max() if nothing is scheduled.
+[[nodiscard]] auto next_deadline() -> std::chrono::steady_clock::time_point;
+              auto dispatch_ready() -> void;
+              auto app_attach(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun = {}) -> void;
+
+// X errors.
+// edwin never makes a round trip just to find out whether a request
+// succeeded, and it installs an error handler so that failures aren't
+// fatal. Errors are recorded by request serial as they come in, and can
+// be checked for afterwards:
+//
+//   const auto mark = edwin::mark_x_errors();
+//   const auto wnd  = edwin::create(std::move(cfg));
+//   ...
+//   if (edwin::check_x_errors(mark) == edwin::x_error_status::failed) { ... }
+//
+// The answer is pending until the server has processed every request made
+// up to the check, which we only find out about when something is read
+// from the connection anyway (the next event or reply.) So check again
+// later, e.g. after the next process_messages(). With XCB, the first check
+// after a mark sends one request whose reply settles it, unless the
+// connection is shared.
+//
+// With a connection shared through set_xdisplay(), errors are still
+// passed on to the host's error handler after being recorded.
+struct x_error      { uint64_t serial; uint8_t error_code; uint8_t request_code; uint8_t minor_code; };
+struct x_error_mark { uint64_t serial; };
+enum class x_error_status { none, pending, failed };
+[[nodiscard]] auto mark_x_errors() -> x_error_mark;
+// If first is given and there was an error, it gets the earliest one
+// which is still remembered.
+[[nodiscard]] auto check_x_errors(x_error_mark since, x_error* first = nullptr) -> x_error_status;
+
+// Recording and replaying events.
+// Every event which edwin dispatches to one of its windows is written to
+// the file along with when it arrived, until stop_recording(). Replaying
+// feeds the events back through the same dispatch code, and so through
+// the same callbacks, without needing the X server to produce them. The
+// application has to have opened the same windows, in the same order, as
+// when the recording was made. Events are replayed either as fast as
+// possible, for benchmarking dispatch and callback costs, or with the
+// recorded timing. A recorded close only calls on_closed, so the window
+// stays open unless the callback destroys it. Replayed events aren't
+// written to a recording which is open at the time.
+enum class replay_speed { full, real_time };
+[[nodiscard]] auto record_events(const char* path) -> bool;
+              auto stop_recording() -> void;
+              auto replay_events(const char* path, replay_speed speed = replay_speed::full) -> bool;
+
 } // edwin
 
 #endif
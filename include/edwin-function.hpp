@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace edwin {
+
+template <typename Sig>
+struct function;
+
+template <typename T>   struct is_std_function                     : std::false_type {};
+template <typename Sig> struct is_std_function<std::function<Sig>> : std::true_type {};
+
+// Move-only replacement for std::function which is used for all of edwin's
+// callbacks. Callables which fit in the inline buffer (a lambda capturing
+// up to four pointers' worth, or a plain function pointer) are stored
+// without allocating. Bigger ones are allocated once, when the function
+// is constructed, and never again after that because it can only be
+// moved.
+template <typename R, typename... Args>
+struct function<R(Args...)> {
+	static constexpr auto BUFFER_SIZE = 4 * sizeof(void*);
+	function() noexcept = default;
+	function(std::nullptr_t) noexcept {}
+	template <typename Fn>
+		requires (!std::is_same_v<std::remove_cvref_t<Fn>, function> && std::is_invocable_r_v<R, std::decay_t<Fn>&, Args...>)
+	function(Fn&& fn) {
+		using T = std::decay_t<Fn>;
+		using U = std::remove_cvref_t<Fn>;
+		if constexpr (std::is_pointer_v<U> || std::is_member_pointer_v<U> || is_std_function<U>::value) {
+			// Stay empty rather than wrapping something empty.
+			if (!fn) {
+				return;
+			}
+		}
+		if constexpr (is_inline<T>()) {
+			::new (static_cast<void*>(buffer_)) T(std::forward<Fn>(fn));
+			vt_ = &inline_vtable<T>;
+		}
+		else {
+			::new (static_cast<void*>(buffer_)) T*(new T(std::forward<Fn>(fn)));
+			vt_ = &heap_vtable<T>;
+		}
+	}
+	function(function&& rhs) noexcept {
+		take(&rhs);
+	}
+	auto operator=(function&& rhs) noexcept -> function& {
+		if (this != &rhs) {
+			reset();
+			take(&rhs);
+		}
+		return *this;
+	}
+	auto operator=(std::nullptr_t) noexcept -> function& {
+		reset();
+		return *this;
+	}
+	function(const function&) = delete;
+	auto operator=(const function&) -> function& = delete;
+	~function() {
+		reset();
+	}
+	explicit operator bool() const noexcept {
+		return vt_ != nullptr;
+	}
+	// Like std::function, a const function can call a mutable callable.
+	auto operator()(Args... args) const -> R {
+		return vt_->call(const_cast<std::byte*>(buffer_), std::forward<Args>(args)...);
+	}
+private:
+	struct vtable {
+		R (*call)(void* buffer, Args&&... args);
+		void (*move)(void* dst, void* src) noexcept;
+		void (*destroy)(void* buffer) noexcept;
+	};
+	template <typename T>
+	static constexpr auto is_inline() -> bool {
+		return sizeof(T) <= BUFFER_SIZE && alignof(T) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<T>;
+	}
+	template <typename T>
+	static constexpr vtable inline_vtable = {
+		[](void* buffer, Args&&... args) -> R { return std::invoke(*static_cast<T*>(buffer), std::forward<Args>(args)...); },
+		[](void* dst, void* src) noexcept { ::new (dst) T(std::move(*static_cast<T*>(src))); static_cast<T*>(src)->~T(); },
+		[](void* buffer) noexcept { static_cast<T*>(buffer)->~T(); },
+	};
+	template <typename T>
+	static constexpr vtable heap_vtable = {
+		[](void* buffer, Args&&... args) -> R { return std::invoke(**static_cast<T**>(buffer), std::forward<Args>(args)...); },
+		[](void* dst, void* src) noexcept { ::new (dst) T*(*static_cast<T**>(src)); },
+		[](void* buffer) noexcept { delete *static_cast<T**>(buffer); },
+	};
+	auto take(function* rhs) noexcept -> void {
+		if (rhs->vt_) {
+			rhs->vt_->move(buffer_, rhs->buffer_);
+			vt_ = std::exchange(rhs->vt_, nullptr);
+		}
+	}
+	auto reset() noexcept -> void {
+		if (vt_) {
+			std::exchange(vt_, nullptr)->destroy(buffer_);
+		}
+	}
+	alignas(std::max_align_t) std::byte buffer_[BUFFER_SIZE];
+	const vtable* vt_ = nullptr;
+};
+
+} // edwin
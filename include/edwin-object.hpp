@@ -7,7 +7,7 @@ namespace edwin {
 
 struct object {
 	object() = delete;
-	object(window_config cfg) : wnd_{create(cfg)} {
+	object(window_config cfg) : wnd_{create(std::move(cfg))} {
 		if (!wnd_) {
 			throw std::runtime_error("Failed to create window.");
 		}
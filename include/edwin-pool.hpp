@@ -0,0 +1,127 @@
+#pragma once
+
+#include "edwin.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace edwin {
+
+struct pool_config {
+	int capacity = 4;                 // How many hidden windows to keep ready.
+	edwin::native_handle parent = {}; // Native handle of the 'parent' window for all of the windows. Only relevant on Windows.
+	edwin::size size = {};            // Size to create the hidden windows with. Picking the usual size saves a resize when acquire() hands out a window which hasn't been used yet.
+};
+
+// Keeps some hidden windows around so that opening a window is just a
+// matter of reconfiguring and showing one of them, and closing it is just
+// hiding it again. Useful when windows are opened and closed all the time,
+// e.g. plugin editors.
+//   auto editors = edwin::pool{{.capacity = 2, .size = {800, 600}}};
+//   auto wnd = editors.acquire(cfg);
+//   ...
+//   editors.release(wnd);
+// acquire() ignores cfg.parent, the pool's parent is used instead. If the
+// user closes an acquired window it's destroyed as usual, so don't release
+// it after on_closed is called. An empty icon leaves the window with
+// whatever icon it had before.
+struct pool {
+	pool(pool_config cfg) : cfg_{cfg} { fill(); }
+	~pool() {
+		for (const auto& w : idle_) {
+			// On macOS destroying a window calls on_closed.
+			set(w.wnd, fn::on_window_closed{});
+			destroy(w.wnd);
+		}
+	}
+	pool(const pool&) = delete;
+	pool& operator=(const pool&) = delete;
+	// Returns a window configured with cfg. Only creates a new window if the
+	// pool is empty.
+	[[nodiscard]] auto acquire(window_config cfg) -> window* {
+		if (idle_.empty()) {
+			cfg.parent = cfg_.parent;
+			return create(std::move(cfg));
+		}
+		const auto [wnd, pooled_size] = idle_.back();
+		idle_.pop_back();
+		set(wnd, std::move(cfg.on_closed));
+		set(wnd, std::move(cfg.on_damaged));
+		set(wnd, std::move(cfg.on_resized));
+		set(wnd, std::move(cfg.on_resizing));
+		set(wnd, std::move(cfg.on_key));
+		set(wnd, std::move(cfg.on_mouse_button));
+		set(wnd, std::move(cfg.on_mouse_move));
+		set(wnd, std::move(cfg.on_mouse_wheel));
+		set(wnd, cfg.compress_motion);
+		set(wnd, cfg.resize_settle);
+		set(wnd, cfg.resize_sync);
+		auto b = batch{wnd};
+		if (cfg.icons.value.empty()) { b.set(cfg.icon); }
+		else                         { b.set(cfg.icons); }
+		const auto same_size = pooled_size && cfg.size.width == cfg_.size.width && cfg.size.height == cfg_.size.height;
+		if (same_size) { b.set(cfg.position); }
+		else           { b.set(cfg.position, cfg.size); }
+		b.set(cfg.resizable);
+		b.set(cfg.title);
+		b.set(cfg.visible);
+		b.commit();
+		return wnd;
+	}
+	// Hides the window and keeps it for the next acquire(), or destroys it if
+	// the pool is already full.
+	auto release(window* wnd) -> void {
+		if (!wnd) {
+			return;
+		}
+		if (int(idle_.size()) >= cfg_.capacity) {
+			destroy(wnd);
+			return;
+		}
+		set(wnd, hide);
+		set(wnd, fn::on_window_damaged{});
+		set(wnd, fn::on_window_resized{});
+		set(wnd, fn::on_window_resizing{});
+		set(wnd, fn::on_key{});
+		set(wnd, fn::on_mouse_button{});
+		set(wnd, fn::on_mouse_move{});
+		set(wnd, fn::on_mouse_wheel{});
+		set(wnd, fn::frame{}, {});
+		// The user may have resized it.
+		keep(wnd, false);
+	}
+	// Creates hidden windows until the pool is full again. acquire() doesn't
+	// do this itself so that it stays fast. Call it at some quiet moment.
+	auto fill() -> void {
+		while (int(idle_.size()) < cfg_.capacity) {
+			auto cfg = window_config{};
+			cfg.parent = cfg_.parent;
+			cfg.size = cfg_.size;
+			const auto wnd = create(std::move(cfg));
+			if (!wnd) {
+				return;
+			}
+			keep(wnd, true);
+		}
+	}
+	[[nodiscard]] auto idle() const -> int {
+		return int(idle_.size());
+	}
+private:
+	struct idle_window {
+		window* wnd;
+		bool pooled_size; // Still the size it was created with.
+	};
+	auto keep(window* wnd, bool pooled_size) -> void {
+		// Something other than the user could still destroy a hidden window,
+		// in which case it must not be handed out again.
+		set(wnd, fn::on_window_closed{[this, wnd] { forget(wnd); }});
+		idle_.push_back({wnd, pooled_size});
+	}
+	auto forget(window* wnd) -> void {
+		idle_.erase(std::remove_if(idle_.begin(), idle_.end(), [wnd](const idle_window& w) { return w.wnd == wnd; }), idle_.end());
+	}
+	pool_config cfg_;
+	std::vector<idle_window> idle_;
+};
+
+} // edwin
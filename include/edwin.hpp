@@ -1,60 +1,233 @@
 #pragma once
 
+#include "edwin-function.hpp"
+#include <array>
 #include <chrono>
 #include <cstddef>
-#include <functional>
+#include <cstdint>
+#include <optional>
 #include <span>
 #include <string_view>
+#include <vector>
 
 namespace edwin {
 
 struct window;
-struct frame_interval { std::chrono::milliseconds value = std::chrono::milliseconds{100}; };
+struct surface;
+enum class overrun_policy { skip, catch_up, rephase };
+enum class mouse_button   { left, middle, right, back, forward };
+struct compress_motion { bool value = true; };
+struct frame_interval { std::chrono::milliseconds value = std::chrono::milliseconds{100}; bool match_display = false; };
+struct frame_overrun  { overrun_policy value = overrun_policy::skip; };
 struct native_handle  { void* value = nullptr; };
 struct position       { int x = 0; int y = 0; }; 
+struct rect           { int x = 0; int y = 0; int width = 0; int height = 0; };
 struct resizable      { bool value = false; };
+struct resize_settle  { std::chrono::milliseconds value = std::chrono::milliseconds{100}; };
+struct resize_sync    { bool value = false; };
 struct size           { int width = 0; int height = 0; }; 
 struct title          { std::string_view value; };
 struct rgba           { std::byte r, g, b, a; };
 struct icon           { edwin::size size; std::span<rgba> pixels; };
+struct icons          { std::span<const edwin::icon> value; };
 struct visible        { bool value = false; };
 
 static constexpr auto show = visible{true};
 static constexpr auto hide = visible{false};
 
+// When an input event happened.
+// server:   Timestamp from the platform in milliseconds. Only useful for comparing
+//           with other events, it wraps around after ~49 days.
+//           Linux: The X server time. Windows: GetMessageTime(). macOS: -[NSEvent timestamp].
+// received: When edwin read the event.
+struct input_time {
+	uint32_t server = 0;
+	std::chrono::steady_clock::time_point received;
+};
+
+struct key_modifiers {
+	bool shift = false;
+	bool ctrl  = false;
+	bool alt   = false;
+	bool super = false;
+};
+
+// Positions are in window coordinates, from the top left.
+struct mouse_move_event {
+	edwin::position position;
+	edwin::key_modifiers modifiers;
+	edwin::input_time time;
+};
+
+struct mouse_button_event {
+	edwin::mouse_button button;
+	bool pressed = false;
+	edwin::position position;
+	edwin::key_modifiers modifiers;
+	edwin::input_time time;
+};
+
+// In notches of the wheel. Positive y is away from the user, positive x is to the right.
+struct mouse_wheel_event {
+	float dx = 0.0f;
+	float dy = 0.0f;
+	edwin::position position;
+	edwin::key_modifiers modifiers;
+	edwin::input_time time;
+};
+
+// keycode is the physical key and keysym the unshifted symbol on it.
+// Linux: X keycode and KeySym. Windows: Scan code and virtual-key code. macOS: -[NSEvent keyCode] for both.
+struct key_event {
+	uint32_t keycode = 0;
+	uint32_t keysym = 0;
+	bool pressed = false;
+	edwin::key_modifiers modifiers;
+	edwin::input_time time;
+};
+
 namespace sig {
 using frame              = void();
 using on_window_closed   = void();
+using on_window_damaged  = void(std::span<const edwin::rect> rects);
 using on_window_resized  = void(edwin::size size);
 using on_window_resizing = void(edwin::size size);
+using on_key             = void(const edwin::key_event& event);
+using on_mouse_button    = void(const edwin::mouse_button_event& event);
+using on_mouse_move      = void(const edwin::mouse_move_event& event);
+using on_mouse_wheel     = void(const edwin::mouse_wheel_event& event);
 } // sig
 
 namespace fn {
-struct frame              { std::function<sig::frame> fn; };
-struct on_window_closed   { std::function<sig::on_window_closed> fn; };
-struct on_window_resized  { std::function<sig::on_window_resized> fn; };
-struct on_window_resizing { std::function<sig::on_window_resizing> fn; };
+struct frame              { edwin::function<sig::frame> fn; };
+struct on_window_closed   { edwin::function<sig::on_window_closed> fn; };
+struct on_window_damaged  { edwin::function<sig::on_window_damaged> fn; };
+struct on_window_resized  { edwin::function<sig::on_window_resized> fn; };
+struct on_window_resizing { edwin::function<sig::on_window_resizing> fn; };
+struct on_key             { edwin::function<sig::on_key> fn; };
+struct on_mouse_button    { edwin::function<sig::on_mouse_button> fn; };
+struct on_mouse_move      { edwin::function<sig::on_mouse_move> fn; };
+struct on_mouse_wheel     { edwin::function<sig::on_mouse_wheel> fn; };
 } // fn
 
+// What app_beg() does when a frame takes longer than the frame interval.
+// skip:     Drop the frames which were missed and carry on with the original phase.
+// catch_up: Run the missed frames back-to-back to catch up. If more than a few were
+//           missed (e.g. the machine was asleep) they are dropped instead.
+// rephase:  Drop the frames which were missed and schedule the next one for one
+//           interval from now.
+// On Windows and macOS the frames are driven by an OS timer which doesn't queue up
+// missed ticks, so skip and rephase behave the same.
+
+// With frame_interval::match_display, app_beg() runs a frame per refresh of the
+// display instead, and value is only used if the refresh rate can't be found out.
+// Linux: The fastest monitor (going by RandR) which one of the top-level windows is
+//        on, or the fastest monitor if none of them have been placed yet. Updated as
+//        windows move and monitors change. The frames aren't synchronized to vblank.
+//        RandR is optional when building (libXrandr, or xcb-randr with EDWIN_XCB),
+//        and without it value is always used.
+// Windows and macOS: The main display, when app_beg() is called.
+
+// Timing of the frames run by app_beg(), see get_frame_stats().
+struct frame_stats {
+	// Upper limits of the histogram buckets. The last bucket has no upper limit.
+	static constexpr std::chrono::nanoseconds limits[] = {
+		std::chrono::microseconds{250}, std::chrono::microseconds{500},
+		std::chrono::milliseconds{1}, std::chrono::milliseconds{2}, std::chrono::milliseconds{4},
+		std::chrono::milliseconds{8}, std::chrono::milliseconds{16}, std::chrono::milliseconds{32},
+	};
+	static constexpr auto BUCKETS = std::size(limits) + 1;
+	uint64_t frames = 0;                            // Frames run since app_beg() or reset_frame_stats().
+	uint64_t missed = 0;                            // Deadlines which were dropped, or served more than an interval late.
+	int samples = 0;                                // How many of the most recent frames the rest is computed from (up to 256).
+	std::chrono::nanoseconds jitter_mean{};         // How far from its deadline a frame started.
+	std::chrono::nanoseconds jitter_max{};
+	std::chrono::nanoseconds duration_mean{};       // How long the frame callback took.
+	std::chrono::nanoseconds duration_max{};
+	std::array<int, BUCKETS> jitter_histogram{};
+	std::array<int, BUCKETS> duration_histogram{};
+};
+
+// What a trace_sink is told about.
+enum class trace_scope {
+	dispatch,    // One pass over the platform's message queue, including the callbacks it triggers.
+	frame,       // The frame callback.
+	on_closed,   // Window callbacks.
+	on_damaged,
+	on_resized,
+	on_resizing,
+	on_key,
+	on_mouse_button,
+	on_mouse_move,
+	on_mouse_wheel,
+	posted,      // Work queued with post().
+	create,      // create(), or the whole of a create_many().
+};
+
+namespace sig {
+using trace_beg   = void(trace_scope scope, const window* wnd);
+using trace_end   = void(trace_scope scope, const window* wnd, std::chrono::nanoseconds elapsed);
+using trace_event = void(const window* wnd, int type);
+} // sig
+
+// Instrumentation, e.g. for feeding into Tracy or Perfetto. Any of these can be
+// left empty. wnd is null for scopes which aren't about one window.
+// beg/end are called around each scope. end also gets the time spent inside it.
+// event is called for every native event edwin dispatches, with the window it's
+// for (null if it's not one of ours).
+//   Linux: type is the X event type, e.g. ConfigureNotify.
+//   Windows: type is the message, e.g. WM_SIZE.
+//   macOS: Not called.
+struct trace_sink {
+	edwin::function<sig::trace_beg> beg = {};
+	edwin::function<sig::trace_end> end = {};
+	edwin::function<sig::trace_event> event = {};
+};
+
 // Any of these fields can be left defaulted.
 // Any of these fields can be changed after the window is created, using the set(...) functions.
+// The callbacks are move-only (see edwin-function.hpp) so this is too. Pass it to create()
+// as a temporary or with std::move().
 struct window_config {
 	edwin::fn::on_window_closed on_closed;     // Function to call when the user closes the window.
+	edwin::fn::on_window_damaged on_damaged;   // Function to call when parts of the window need to be redrawn, e.g. after being uncovered.
 	edwin::fn::on_window_resized on_resized;   // Function to call after the user finishes resizing the window.
 	edwin::fn::on_window_resizing on_resizing; // Function to call while the user is resizing the window.
+	edwin::fn::on_key on_key;                  // Input callbacks.
+	edwin::fn::on_mouse_button on_mouse_button;
+	edwin::fn::on_mouse_move on_mouse_move;
+	edwin::fn::on_mouse_wheel on_mouse_wheel;
+	edwin::compress_motion compress_motion;    // Only report the latest mouse position of each burst of mouse moves. Only relevant on Linux.
 	edwin::icon icon;                          // Icon to associate with the window, in 32-bit RGBA format.
+	edwin::icons icons;                        // Several sizes of the icon, so the platform doesn't have to scale one. Used instead of icon if not empty.
 	edwin::native_handle parent;               // Native handle of the 'parent' window. Only relevant on Windows.
 	edwin::position position;                  // Initial position of the window.
 	edwin::resizable resizable;                // Should the user be able to resize the window?
+	edwin::resize_settle resize_settle;        // How long the size must stay unchanged before on_resized is called. Only relevant on Linux.
+	edwin::resize_sync resize_sync;            // Make the window manager wait for resize_done() during an interactive resize. Only relevant on Linux.
 	edwin::size size;                          // Initial size of the window.
 	edwin::title title;                        // Title text of the window.
 	edwin::visible visible;                    // Should the window be initially visible?
 };
 
               // If your brain is more object-oriented, check out edwin-object.hpp for an RAII wrapper.
+              // If windows are opened and closed all the time, check out edwin-pool.hpp.
+              // For waiting on frames and window events in coroutines, see edwin-coro.hpp.
+              // Linux: The window* is a handle rather than an address, so don't dereference it.
+              //        Once the window has been destroyed it's ignored by everything which
+              //        takes one, even after a new window reuses its slot. Elsewhere it
+              //        mustn't be used again.
 [[nodiscard]] auto create(window_config cfg) -> window*;
               auto destroy(window* wnd) -> void;
 
+              // Creates a window for each config, e.g. for all the plugin editors of a
+              // session which is being loaded. The windows are returned in the same
+              // order, with null for any which couldn't be created. The configs are
+              // moved from. On Linux all the requests go out in one flush of the X
+              // connection instead of one each. The trace_sink sees the whole call as
+              // one trace_scope::create.
+[[nodiscard]] auto create_many(std::span<window_config> cfgs) -> std::vector<window*>;
+
               // Return the native handle for the window.
               // Windows: HWND
               // Linux: Window
@@ -66,19 +239,150 @@ struct window_config {
               // Windows: It will show up in the title bar.
               // Linux: I don't know if it works because my window manager doesn't actually have window icons.
               // macOS: This is a no-op because having individual window icons isn't really a thing AFAIK.
+              // Setting the same pixels again is cheap because converted icons are cached.
+              // Pass several sizes with edwin::icons to let the platform pick the best one.
               auto set(window* wnd, edwin::icon icon) -> void;
-              
+              auto set(window* wnd, edwin::icons icons) -> void;
+
+              // Input.
+              // With compress_motion, consecutive mouse moves which are read in the same
+              // pass over the event queue are reported as one, with the latest position.
+              // Moves are never reordered with other input events. Windows and macOS
+              // already do this themselves.
+              auto set(window* wnd, edwin::compress_motion compress) -> void;
+              auto set(window* wnd, fn::on_key cb) -> void;
+              auto set(window* wnd, fn::on_mouse_button cb) -> void;
+              auto set(window* wnd, fn::on_mouse_move cb) -> void;
+              auto set(window* wnd, fn::on_mouse_wheel cb) -> void;
+
               // Other properties.
               auto set(window* wnd, edwin::position position) -> void;
               auto set(window* wnd, edwin::position position, edwin::size size) -> void;
               auto set(window* wnd, edwin::resizable resizable) -> void;
+              auto set(window* wnd, edwin::resize_settle settle) -> void;
+              auto set(window* wnd, edwin::resize_sync sync) -> void;
               auto set(window* wnd, edwin::size size) -> void;
               auto set(window* wnd, edwin::title title) -> void;
               auto set(window* wnd, edwin::visible visible) -> void;
               auto set(window* wnd, fn::on_window_closed cb) -> void;
+              auto set(window* wnd, fn::on_window_damaged cb) -> void;
               auto set(window* wnd, fn::on_window_resized cb) -> void;
               auto set(window* wnd, fn::on_window_resizing cb) -> void;
 
+              // Per-window frames, for windows which need redrawing at their own rate,
+              // e.g. a meter at 60 Hz next to editors which only need 10 Hz. They run
+              // alongside the frame callback passed to app_beg(). Setting them again
+              // restarts them from now, and an empty callback stops them. Missed frames
+              // are skipped. The callback may replace or stop itself, or destroy its window.
+              // Linux: Run by app_beg() and dispatch_ready() from a min-heap of deadlines,
+              //        and the loop sleeps until the earliest one. Frames which fall due
+              //        within a millisecond of each other are run in the same pass.
+              //        With match_display a top-level window follows the monitor it
+              //        overlaps most, and a child window goes with app_beg()'s monitor.
+              // Windows: A timer per window, so they run in any message loop, including
+              //          the modal loop of a resize.
+              // macOS: An NSTimer per window, run by the main run loop.
+              auto set(window* wnd, fn::frame cb, edwin::frame_interval interval) -> void;
+
+              // Synchronized resizing (_NET_WM_SYNC_REQUEST).
+              // On Linux the window manager can wait for the application to catch up
+              // with each step of an interactive resize, so that the window never
+              // shows stale or stretched contents. By default edwin tells it to carry
+              // on as soon as on_resizing has been called. With resize_sync, edwin
+              // waits for resize_done() instead, which should be called once a frame
+              // has been drawn at the size on_resizing reported. Then the window
+              // manager resizes exactly as fast as the renderer can keep up.
+              // No-op on Windows and macOS.
+              auto resize_done(window* wnd) -> void;
+
+              // on_damaged gets the parts of the window which need to be redrawn. The
+              // rects may overlap. They are only valid during the call.
+              // Linux: All the Expose events for the window in one pass over the event
+              //        queue are collected into a single call.
+              // Windows: Called for WM_PAINT with the update region.
+              // macOS: Called from drawRect:.
+
+              // Thread safety.
+              // Everything else in here has to be called on the thread which processes
+              // window messages. These can be called from any thread. The work is queued
+              // and carried out on that thread the next time it processes messages, and
+              // the caller never waits for it. app_beg() is woken up immediately.
+              // The window has to exist when post() is called. If it's destroyed before
+              // the change is carried out then the change is dropped.
+              // The title and icon pixels are copied.
+              auto post(edwin::function<void()> fn) -> void;
+              auto post(window* wnd, edwin::icon icon) -> void;
+              auto post(window* wnd, edwin::icons icons) -> void;
+              auto post(window* wnd, edwin::position position) -> void;
+              auto post(window* wnd, edwin::position position, edwin::size size) -> void;
+              auto post(window* wnd, edwin::resizable resizable) -> void;
+              auto post(window* wnd, edwin::resize_settle settle) -> void;
+              auto post(window* wnd, edwin::resize_sync sync) -> void;
+              auto post(window* wnd, edwin::size size) -> void;
+              auto post(window* wnd, edwin::title title) -> void;
+              auto post(window* wnd, edwin::visible visible) -> void;
+              auto post(window* wnd, fn::on_window_closed cb) -> void;
+              auto post(window* wnd, fn::on_window_damaged cb) -> void;
+              auto post(window* wnd, fn::on_window_resized cb) -> void;
+              auto post(window* wnd, fn::on_window_resizing cb) -> void;
+              auto post(window* wnd, edwin::compress_motion compress) -> void;
+              auto post(window* wnd, fn::on_key cb) -> void;
+              auto post(window* wnd, fn::on_mouse_button cb) -> void;
+              auto post(window* wnd, fn::on_mouse_move cb) -> void;
+              auto post(window* wnd, fn::on_mouse_wheel cb) -> void;
+              auto post(window* wnd, fn::frame cb, edwin::frame_interval interval) -> void;
+
+              // Collects several property changes and applies them together.
+              // Changes to the same property are merged, so only the last one is applied,
+              // and the platform is asked to do the least amount of work possible, e.g.
+              // on Linux the changes cost one flush of the X connection instead of one
+              // request (or more) per property.
+              //   auto b = edwin::batch{wnd};
+              //   b.set(edwin::size{800, 600});
+              //   b.set(edwin::title{"Editor"});
+              //   b.commit();
+              // The title and icon are not copied, so they need to stay alive until
+              // commit() is called.
+struct batch {
+	explicit batch(window* wnd) : wnd_{wnd} {}
+	auto set(edwin::icon icon) -> batch&                            { icon_ = icon; icons_.reset(); return *this; }
+	auto set(edwin::icons icons) -> batch&                          { icons_ = icons; icon_.reset(); return *this; }
+	auto set(edwin::position position) -> batch&                    { position_ = position; return *this; }
+	auto set(edwin::position position, edwin::size size) -> batch& { position_ = position; size_ = size; return *this; }
+	auto set(edwin::resizable resizable) -> batch&                  { resizable_ = resizable; return *this; }
+	auto set(edwin::size size) -> batch&                            { size_ = size; return *this; }
+	auto set(edwin::title title) -> batch&                          { title_ = title; return *this; }
+	auto set(edwin::visible visible) -> batch&                      { visible_ = visible; return *this; }
+	auto commit() -> void;
+private:
+	window* wnd_;
+	std::optional<edwin::icon> icon_;
+	std::optional<edwin::icons> icons_;
+	std::optional<edwin::position> position_;
+	std::optional<edwin::resizable> resizable_;
+	std::optional<edwin::size> size_;
+	std::optional<edwin::title> title_;
+	std::optional<edwin::visible> visible_;
+};
+
+              // Software rendering.
+              // A surface is a buffer of RGBA pixels which is shown in the window when
+              // present() is called. acquire() returns the buffer, which is always the
+              // size of the window, so call it again every frame. The contents are kept
+              // between frames, unless the window was resized, in which case they are
+              // cleared. Pass the rects which changed to present(), or nothing to show
+              // the whole buffer. get_size() is the size of the buffer returned by the
+              // last acquire(). Destroy the surface before the window.
+              // Linux: Presented with MIT-SHM, double buffered, when the X server is local.
+              //        Otherwise the pixels are sent over the X connection.
+              // Windows: Presented with SetDIBitsToDevice.
+              // macOS: The whole buffer becomes the contents of the view's layer.
+[[nodiscard]] auto create_surface(window* wnd) -> surface*;
+              auto destroy(surface* surf) -> void;
+[[nodiscard]] auto acquire(surface* surf) -> std::span<rgba>;
+[[nodiscard]] auto get_size(const surface& surf) -> edwin::size;
+              auto present(surface* surf, std::span<const rect> dirty = {}) -> void;
+
               // How to process window messages.
               // This varies according the the stupidity of the platform.
 
@@ -108,7 +412,18 @@ struct window_config {
               // There's never any reason to mix both process_messages() and app_beg()/app_end().
               // Just do one or the other.
               auto process_messages() -> void;
-              auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval) -> void;
+              auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun = {}) -> void;
               auto app_end() -> void;
 
+              // Frame timing of app_beg(). Call these on the same thread as app_beg(),
+              // e.g. from the frame callback. The stats are reset when app_beg() starts.
+[[nodiscard]] auto get_frame_stats() -> frame_stats;
+              auto reset_frame_stats() -> void;
+
+              // Install a trace_sink, or pass an empty one to uninstall it. Costs nothing
+              // measurable when there isn't one. Call this on the thread which processes
+              // window messages. If it's called from inside one of the sink's own
+              // functions, the new sink is installed once that function returns.
+              auto set_trace_sink(trace_sink sink) -> void;
+
 } // edwin
@@ -0,0 +1,128 @@
+#pragma once
+
+// The backend side of edwin-coro.hpp, shared by all the backends. They
+// call resume_resized() after on_resized and resume_window_waiters() once
+// a window has been destroyed. Frame waiters are resumed by run_frame().
+// They also implement is_alive(), so that nobody waits on a window which
+// is already gone.
+
+#include "edwin-coro.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace edwin {
+
+// Coroutine frames are rounded up to a multiple of this, and frames up to
+// CORO_SIZE_CLASSES of them are recycled. Bigger ones are rare enough to
+// go straight to the heap.
+static constexpr size_t CORO_GRANULE      = 64;
+static constexpr size_t CORO_SIZE_CLASSES = 16;
+
+struct coro_block {
+	coro_block* next;
+};
+
+struct window_waiter {
+	window* wnd;
+	std::coroutine_handle<> coro;
+	// Only for resized().
+	std::optional<edwin::size>* result = nullptr;
+};
+
+static coro_block* coro_free_[CORO_SIZE_CLASSES] = {};
+static std::vector<std::coroutine_handle<>> frame_waiters_;
+static std::vector<window_waiter> resized_waiters_;
+static std::vector<window_waiter> closed_waiters_;
+
+static
+auto is_alive(window* wnd) -> bool;
+
+auto alloc_coro_frame(size_t size) -> void* {
+	const auto size_class = (size + CORO_GRANULE - 1) / CORO_GRANULE;
+	if (size_class == 0 || size_class > CORO_SIZE_CLASSES) {
+		return ::operator new(size);
+	}
+	if (const auto block = coro_free_[size_class - 1]) {
+		coro_free_[size_class - 1] = block->next;
+		return block;
+	}
+	return ::operator new(size_class * CORO_GRANULE);
+}
+
+auto free_coro_frame(void* ptr, size_t size) -> void {
+	const auto size_class = (size + CORO_GRANULE - 1) / CORO_GRANULE;
+	if (size_class == 0 || size_class > CORO_SIZE_CLASSES) {
+		::operator delete(ptr);
+		return;
+	}
+	const auto block = static_cast<coro_block*>(ptr);
+	block->next = coro_free_[size_class - 1];
+	coro_free_[size_class - 1] = block;
+}
+
+auto await_frame(std::coroutine_handle<> coro) -> void {
+	frame_waiters_.push_back(coro);
+}
+
+auto await_resized(window* wnd, std::coroutine_handle<> coro, std::optional<edwin::size>* result) -> bool {
+	if (!is_alive(wnd)) { return false; }
+	resized_waiters_.push_back({wnd, coro, result});
+	return true;
+}
+
+auto await_closed(window* wnd, std::coroutine_handle<> coro) -> bool {
+	if (!is_alive(wnd)) { return false; }
+	closed_waiters_.push_back({wnd, coro});
+	return true;
+}
+
+// Coroutines which co_await next_frame() again wait for the frame after.
+static
+auto resume_frame_waiters() -> void {
+	static std::vector<std::coroutine_handle<>> waiters;
+	waiters.swap(frame_waiters_);
+	for (const auto coro : waiters) {
+		coro.resume();
+	}
+	waiters.clear();
+}
+
+// Moves the waiters for wnd out of the list before any of them are
+// resumed, because resuming can add waiters, or even resize another
+// window on the spot (on Windows.)
+static
+auto take_waiters(std::vector<window_waiter>* waiters, window* wnd) -> std::vector<window_waiter> {
+	auto taken = std::vector<window_waiter>{};
+	const auto pos = std::stable_partition(waiters->begin(), waiters->end(), [wnd](const window_waiter& w) { return w.wnd != wnd; });
+	taken.assign(pos, waiters->end());
+	waiters->erase(pos, waiters->end());
+	return taken;
+}
+
+static
+auto resume_resized(window* wnd, edwin::size size) -> void {
+	if (resized_waiters_.empty()) {
+		return;
+	}
+	for (const auto& w : take_waiters(&resized_waiters_, wnd)) {
+		*w.result = size;
+		w.coro.resume();
+	}
+}
+
+// wnd may already have been deleted. It's only used to find the waiters.
+static
+auto resume_window_waiters(window* wnd) -> void {
+	if (!resized_waiters_.empty()) {
+		for (const auto& w : take_waiters(&resized_waiters_, wnd)) {
+			w.coro.resume();
+		}
+	}
+	if (!closed_waiters_.empty()) {
+		for (const auto& w : take_waiters(&closed_waiters_, wnd)) {
+			w.coro.resume();
+		}
+	}
+}
+
+} // edwin
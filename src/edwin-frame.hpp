@@ -0,0 +1,166 @@
+#pragma once
+
+// Frame scheduling and timing statistics, shared by all the backends.
+
+#include "edwin.hpp"
+#include "edwin-await.hpp"
+#include "edwin-trace.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace edwin {
+
+static constexpr auto FRAME_HISTORY   = 256;
+static constexpr auto MAX_CATCH_UP    = 8;
+
+struct frame_sample {
+	std::chrono::nanoseconds jitter;
+	std::chrono::nanoseconds duration;
+};
+
+static std::array<frame_sample, FRAME_HISTORY> frame_samples_;
+static uint64_t frames_ = 0;
+static uint64_t frames_missed_ = 0;
+
+static
+auto record_frame(std::chrono::nanoseconds jitter, std::chrono::nanoseconds duration) -> void {
+	frame_samples_[frames_ % FRAME_HISTORY] = {jitter, duration};
+	frames_++;
+}
+
+// Runs the frame callback, and then any coroutines waiting for the
+// frame, and records how long it all took.
+static
+auto run_frame(const edwin::fn::frame& frame, std::chrono::nanoseconds jitter) -> void {
+	const auto beg = std::chrono::steady_clock::now();
+	invoke(trace_scope::frame, nullptr, frame.fn);
+	resume_frame_waiters();
+	record_frame(jitter, std::chrono::steady_clock::now() - beg);
+}
+
+// For platforms where we decide when frames happen (Linux). Call
+// run_due() whenever the loop wakes up and sleep until next.
+struct frame_clock {
+	using clock = std::chrono::steady_clock;
+	clock::duration interval;
+	edwin::frame_overrun overrun;
+	clock::time_point next = clock::now();
+	// Runs a frame if one is due. Returns true if it did.
+	auto run_due(const edwin::fn::frame& frame) -> bool {
+		const auto now = clock::now();
+		if (now < next) {
+			return false;
+		}
+		const auto lateness = now - next;
+		if (interval.count() > 0 && lateness >= interval) {
+			frames_missed_++;
+		}
+		run_frame(frame, lateness);
+		advance(clock::now());
+		return true;
+	}
+private:
+	auto advance(clock::time_point now) -> void {
+		next += interval;
+		if (next > now || interval.count() <= 0) {
+			return;
+		}
+		// The frame overran.
+		const auto behind = (now - next) / interval + 1;
+		switch (overrun.value) {
+			case overrun_policy::catch_up: {
+				if (behind <= MAX_CATCH_UP) {
+					// The missed frames are run back-to-back, and counted
+					// as missed when they start late.
+					return;
+				}
+				// Too far behind to be worth it (e.g. the machine was
+				// asleep), so fall through and skip.
+				[[fallthrough]];
+			}
+			case overrun_policy::skip: {
+				// Stay on the original phase.
+				frames_missed_ += behind;
+				next += behind * interval;
+				return;
+			}
+			case overrun_policy::rephase: {
+				frames_missed_ += behind;
+				next = now + interval;
+				return;
+			}
+		}
+	}
+};
+
+// For platforms where a repeating OS timer decides when frames happen
+// (Windows, macOS). Call on_tick() from the timer callback.
+struct frame_ticker {
+	using clock = std::chrono::steady_clock;
+	clock::duration interval;
+	edwin::frame_overrun overrun;
+	clock::time_point last = {};
+	auto on_tick(const edwin::fn::frame& frame) -> void {
+		const auto now = clock::now();
+		if (last == clock::time_point{} || interval.count() <= 0) {
+			last = now;
+			run_frame(frame, {});
+			return;
+		}
+		const auto gap = now - last;
+		last = now;
+		const auto jitter = gap > interval ? gap - interval : interval - gap;
+		// OS timers don't queue up missed ticks, so the policies only
+		// differ in whether the missed frames are run now. The phase is
+		// up to the OS.
+		const auto missed = std::max<int64_t>(0, gap / interval - 1);
+		frames_missed_ += missed;
+		const auto extra = overrun.value == overrun_policy::catch_up ? std::min<int64_t>(missed, MAX_CATCH_UP) : 0;
+		for (auto i = int64_t{0}; i <= extra; i++) {
+			run_frame(frame, jitter);
+		}
+	}
+};
+
+static
+auto bucket(std::chrono::nanoseconds value) -> size_t {
+	for (size_t i = 0; i < std::size(frame_stats::limits); i++) {
+		if (value < frame_stats::limits[i]) {
+			return i;
+		}
+	}
+	return std::size(frame_stats::limits);
+}
+
+auto get_frame_stats() -> frame_stats {
+	auto stats = frame_stats{};
+	stats.frames  = frames_;
+	stats.missed  = frames_missed_;
+	stats.samples = static_cast<int>(std::min<uint64_t>(frames_, FRAME_HISTORY));
+	if (stats.samples == 0) {
+		return stats;
+	}
+	auto jitter_total   = std::chrono::nanoseconds{};
+	auto duration_total = std::chrono::nanoseconds{};
+	for (auto i = 0; i < stats.samples; i++) {
+		const auto& sample = frame_samples_[i];
+		jitter_total   += sample.jitter;
+		duration_total += sample.duration;
+		stats.jitter_max   = std::max(stats.jitter_max, sample.jitter);
+		stats.duration_max = std::max(stats.duration_max, sample.duration);
+		stats.jitter_histogram[bucket(sample.jitter)]++;
+		stats.duration_histogram[bucket(sample.duration)]++;
+	}
+	stats.jitter_mean   = jitter_total / stats.samples;
+	stats.duration_mean = duration_total / stats.samples;
+	return stats;
+}
+
+auto reset_frame_stats() -> void {
+	frames_ = 0;
+	frames_missed_ = 0;
+}
+
+} // edwin
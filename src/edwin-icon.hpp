@@ -0,0 +1,224 @@
+#pragma once
+
+// Icon pixel conversion and caching, shared by the Windows and Linux backends.
+
+#include "edwin.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define EDWIN_ICON_SSE2 1
+#	include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	define EDWIN_ICON_NEON 1
+#	include <arm_neon.h>
+#endif
+
+namespace edwin {
+
+static_assert(sizeof(rgba) == 4);
+
+[[nodiscard]] static
+auto is_valid(const edwin::icon& icon) -> bool {
+	return icon.size.width > 0 && icon.size.height > 0 && icon.pixels.size() >= size_t(icon.size.width) * size_t(icon.size.height);
+}
+
+[[nodiscard]] static
+auto pixel_count(const edwin::icon& icon) -> size_t {
+	return size_t(icon.size.width) * size_t(icon.size.height);
+}
+
+// Swap the R and B bytes of a pixel. Reading the result as a little-endian
+// 32-bit value gives 0xAARRGGBB, which is what _NET_WM_ICON wants, and in
+// memory it's BGRA, which is what a Windows DIB wants.
+[[nodiscard]] static
+auto swap_rb(uint32_t px) -> uint32_t {
+	const auto ga = px & 0xFF00FF00u;
+	const auto rb = px & 0x00FF00FFu;
+	return ga | (rb << 16) | (rb >> 16);
+}
+
+static
+auto rgba_to_argb(const rgba* src, uint32_t* dst, size_t count) -> void {
+	auto i = size_t{0};
+#if EDWIN_ICON_SSE2
+	const auto ga_mask = _mm_set1_epi32(int(0xFF00FF00u));
+	const auto rb_mask = _mm_set1_epi32(0x00FF00FF);
+	for (; i + 4 <= count; i += 4) {
+		const auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		const auto ga = _mm_and_si128(px, ga_mask);
+		const auto rb = _mm_and_si128(px, rb_mask);
+		const auto br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(ga, br));
+	}
+#elif EDWIN_ICON_NEON
+	for (; i + 16 <= count; i += 16) {
+		auto px = vld4q_u8(reinterpret_cast<const uint8_t*>(src + i));
+		const auto r = px.val[0];
+		px.val[0] = px.val[2];
+		px.val[2] = r;
+		vst4q_u8(reinterpret_cast<uint8_t*>(dst + i), px);
+	}
+#endif
+	for (; i < count; i++) {
+		uint32_t px;
+		std::memcpy(&px, src + i, sizeof(px));
+		dst[i] = swap_rb(px);
+	}
+}
+
+#if defined(__linux__) && !defined(EDWIN_XCB)
+// Xlib wants format 32 property data as an array of longs, which are
+// 64 bits on LP64 platforms.
+static
+auto rgba_to_argb(const rgba* src, unsigned long* dst, size_t count) -> void {
+	if constexpr (sizeof(unsigned long) == sizeof(uint32_t)) {
+		rgba_to_argb(src, reinterpret_cast<uint32_t*>(dst), count);
+		return;
+	}
+	auto i = size_t{0};
+#if EDWIN_ICON_SSE2
+	const auto ga_mask = _mm_set1_epi32(int(0xFF00FF00u));
+	const auto rb_mask = _mm_set1_epi32(0x00FF00FF);
+	const auto zero    = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4) {
+		const auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		const auto ga = _mm_and_si128(px, ga_mask);
+		const auto rb = _mm_and_si128(px, rb_mask);
+		const auto argb = _mm_or_si128(ga, _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 0), _mm_unpacklo_epi32(argb, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 2), _mm_unpackhi_epi32(argb, zero));
+	}
+#elif EDWIN_ICON_NEON
+	for (; i + 4 <= count; i += 4) {
+		auto px = vld1q_u32(reinterpret_cast<const uint32_t*>(src + i));
+		const auto ga = vandq_u32(px, vdupq_n_u32(0xFF00FF00u));
+		const auto rb = vandq_u32(px, vdupq_n_u32(0x00FF00FFu));
+		const auto argb = vorrq_u32(ga, vorrq_u32(vshlq_n_u32(rb, 16), vshrq_n_u32(rb, 16)));
+		vst1q_u64(reinterpret_cast<uint64_t*>(dst + i + 0), vmovl_u32(vget_low_u32(argb)));
+		vst1q_u64(reinterpret_cast<uint64_t*>(dst + i + 2), vmovl_u32(vget_high_u32(argb)));
+	}
+#endif
+	for (; i < count; i++) {
+		uint32_t px;
+		std::memcpy(&px, src + i, sizeof(px));
+		dst[i] = swap_rb(px);
+	}
+}
+#endif
+
+// Not cryptographic, it just has to be fast and tell different icons apart.
+[[nodiscard]] static
+auto hash_icons(std::span<const edwin::icon> icons) -> uint64_t {
+	static constexpr auto K = 0x9E3779B97F4A7C15ull;
+	auto h = uint64_t{0xCBF29CE484222325ull};
+	auto mix = [&h](uint64_t v) {
+		h ^= v;
+		h *= K;
+		h ^= h >> 32;
+	};
+	for (const auto& icon : icons) {
+		mix((uint64_t(uint32_t(icon.size.width)) << 32) | uint32_t(icon.size.height));
+		const auto bytes = reinterpret_cast<const unsigned char*>(icon.pixels.data());
+		const auto length = pixel_count(icon) * sizeof(rgba);
+		auto i = size_t{0};
+		for (; i + 8 <= length; i += 8) {
+			uint64_t v;
+			std::memcpy(&v, bytes + i, sizeof(v));
+			mix(v);
+		}
+		for (; i < length; i++) {
+			mix(bytes[i]);
+		}
+	}
+	return h;
+}
+
+// A copy of the icons which a cache entry was made from. The hash only
+// narrows things down, so a hit is confirmed by comparing these. The
+// vectors are reused, so assigning doesn't allocate unless the icons got
+// bigger.
+struct icon_source {
+	std::vector<edwin::size> sizes;
+	std::vector<rgba> pixels;
+	auto assign(std::span<const edwin::icon> icons) -> void {
+		sizes.clear();
+		pixels.clear();
+		for (const auto& icon : icons) {
+			sizes.push_back(icon.size);
+			pixels.insert(pixels.end(), icon.pixels.begin(), icon.pixels.begin() + pixel_count(icon));
+		}
+	}
+	[[nodiscard]] auto matches(std::span<const edwin::icon> icons) const -> bool {
+		if (icons.size() != sizes.size()) {
+			return false;
+		}
+		auto offset = size_t{0};
+		for (size_t i = 0; i < icons.size(); i++) {
+			const auto& icon = icons[i];
+			const auto count = pixel_count(icon);
+			if (icon.size.width != sizes[i].width || icon.size.height != sizes[i].height) {
+				return false;
+			}
+			if (std::memcmp(icon.pixels.data(), pixels.data() + offset, count * sizeof(rgba)) != 0) {
+				return false;
+			}
+			offset += count;
+		}
+		return true;
+	}
+};
+
+// Converted _NET_WM_ICON data for the last few distinct icons, so setting
+// the same icon again costs a hash and a compare of the pixels and nothing
+// else. The vectors are reused when entries are evicted, so once the
+// cache is warm a miss doesn't allocate either unless the icon got bigger.
+template <typename T>
+struct icon_cache {
+	static constexpr auto CAPACITY = 8;
+	[[nodiscard]] auto get(std::span<const edwin::icon> icons) -> const std::vector<T>& {
+		const auto hash = hash_icons(icons);
+		tick_++;
+		for (auto& e : entries_) {
+			if (e.used && e.hash == hash && e.source.matches(icons)) {
+				e.used = tick_;
+				return e.data;
+			}
+		}
+		auto& e = *std::min_element(entries_.begin(), entries_.end(), [](const entry& a, const entry& b) { return a.used < b.used; });
+		e.hash = hash;
+		e.used = tick_;
+		e.source.assign(icons);
+		convert(icons, &e.data);
+		return e.data;
+	}
+private:
+	struct entry {
+		uint64_t hash = 0;
+		uint64_t used = 0;
+		icon_source source;
+		std::vector<T> data;
+	};
+	static auto convert(std::span<const edwin::icon> icons, std::vector<T>* out) -> void {
+		auto length = size_t{0};
+		for (const auto& icon : icons) {
+			length += 2 + pixel_count(icon);
+		}
+		out->resize(length);
+		auto dst = out->data();
+		for (const auto& icon : icons) {
+			*dst++ = T(icon.size.width);
+			*dst++ = T(icon.size.height);
+			rgba_to_argb(icon.pixels.data(), dst, pixel_count(icon));
+			dst += pixel_count(icon);
+		}
+	}
+	std::array<entry, CAPACITY> entries_;
+	uint64_t tick_ = 0;
+};
+
+} // edwin
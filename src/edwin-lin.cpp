@@ -1,134 +1,232 @@
-#include "edwin.hpp"
-#include <chrono>
-#include <memory>
-#include <thread>
-#include <vector>
+#include "edwin-icon.hpp"
+#include "edwin-surface.hpp"
+#include "edwin-x11.hpp"
+#include "edwin-post.hpp"
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/sync.h>
+#if defined(EDWIN_RANDR)
+#include <X11/extensions/Xrandr.h>
+#endif
 
 namespace edwin {
 
-static constexpr auto MIN_SIZE = 10;
-static constexpr auto MAX_SIZE = 10000;
+static Atom atoms_[size_t(atom::count)] = {};
+// Event type of XShmCompletionEvent, or -1 if MIT-SHM isn't there.
+static int shm_completion_ = -1;
+// Whether new surfaces should try MIT-SHM. Cleared after a failed attempt,
+// while surfaces which already have SHM images keep getting completions.
+static bool shm_available_ = false;
+// Whether the SYNC extension is there for _NET_WM_SYNC_REQUEST.
+static bool sync_available_ = false;
+static Display* xdisplay_ = nullptr;
+static bool xdisplay_opened_ = false;
+// The connection belongs to the host (set_xdisplay()), which also owns
+// the event queue.
+static bool xdisplay_shared_ = false;
+static XErrorHandler previous_error_handler_ = nullptr;
+// RandR's first event, once open_randr() has found it.
+static int randr_event_base_ = -1;
+// Serial of the XShmAttach() which checks whether the server can see our
+// shared memory. Failing is expected when it's remote, so the host
+// doesn't hear about it.
+static unsigned long shm_attach_serial_ = 0;
 
-struct window {
-	Window xwindow = 0;
-	edwin::resizable resizable;
-	edwin::size size;
-	fn::on_window_closed on_closed;
-	fn::on_window_resized on_resized;
-	fn::on_window_resizing on_resizing;
-};
+// Xlib's default handler exits the process, even for something as
+// harmless as destroying a window which is already gone.
+static
+auto on_x_error(Display* xdisplay, XErrorEvent* error) -> int {
+	if (xdisplay != xdisplay_) {
+		return previous_error_handler_ ? previous_error_handler_(xdisplay, error) : 0;
+	}
+	record_x_error({error->serial, error->error_code, error->request_code, error->minor_code});
+	if (xdisplay_shared_ && previous_error_handler_ && !(shm_attach_serial_ && error->serial == shm_attach_serial_)) {
+		return previous_error_handler_(xdisplay, error);
+	}
+	return 0;
+}
 
-struct entry {
-	Window xwindow;
-	window* wnd;
-};
+static
+auto init_xdisplay(Display* xdisplay) -> void {
+	previous_error_handler_ = XSetErrorHandler(on_x_error);
+	// One round trip for all of them, instead of one per setter call.
+	XInternAtoms(xdisplay, const_cast<char**>(atom_names), int(atom::count), False, atoms_);
+	if (XShmQueryExtension(xdisplay)) {
+		shm_completion_ = XShmGetEventBase(xdisplay) + ShmCompletion;
+		shm_available_ = true;
+	}
+	int sync_event_base, sync_error_base, sync_major, sync_minor;
+	if (XSyncQueryExtension(xdisplay, &sync_event_base, &sync_error_base)) {
+		sync_available_ = XSyncInitialize(xdisplay, &sync_major, &sync_minor);
+	}
+}
+
+auto get_xdisplay() -> Display* {
+	if (!xdisplay_ && !std::exchange(xdisplay_opened_, true)) {
+		if ((xdisplay_ = XOpenDisplay(nullptr))) {
+			init_xdisplay(xdisplay_);
+		}
+	}
+	return xdisplay_;
+}
 
-static std::vector<entry> window_list_;
-static fn::frame app_frame_;
-static bool app_schedule_stop_ = false;
+auto set_xdisplay(Display* xdisplay) -> void {
+	if (xdisplay_ || !xdisplay) {
+		return;
+	}
+	xdisplay_        = xdisplay;
+	xdisplay_opened_ = true;
+	xdisplay_shared_ = true;
+	init_xdisplay(xdisplay);
+}
 
 static
-auto get_xdisplay() -> Display* {
-	static auto xdisplay = XOpenDisplay(nullptr);
-	return xdisplay;
+auto get_atom(atom a) -> Atom {
+	return atoms_[size_t(a)];
 }
 
+// Handle WM_DELETE_WINDOW ourselves instead of letting the window manager
+// kill the connection, and take part in _NET_WM_SYNC_REQUEST if we can.
 static
-auto get_window(Window xwindow) -> window* {
-	for (const auto& entry : window_list_) {
-		if (entry.xwindow == xwindow) {
-			return entry.wnd;
-		}
+auto write_protocols(window* wnd) -> void {
+	const auto xdisplay = get_xdisplay();
+	Atom protocols[2] = {get_atom(atom::wm_delete_window)};
+	auto count = 1;
+	if (sync_available_) {
+		XSyncValue value;
+		XSyncIntToValue(&value, 0);
+		wnd->sync_counter = static_cast<uint32_t>(XSyncCreateCounter(xdisplay, value));
+		const auto counter = static_cast<unsigned long>(wnd->sync_counter);
+		XChangeProperty(xdisplay, wnd->xwindow, get_atom(atom::net_wm_sync_request_counter), XA_CARDINAL, 32, PropModeReplace, reinterpret_cast<const unsigned char*>(&counter), 1);
+		protocols[count++] = get_atom(atom::net_wm_sync_request);
 	}
-	return nullptr;
+	XSetWMProtocols(xdisplay, wnd->xwindow, protocols, count);
 }
 
-auto create(window_config cfg) -> window* {
-	auto wnd = std::make_unique<window>();
+static
+auto write_sync_counter(window* wnd, int64_t value) -> void {
+	XSyncValue v;
+	XSyncIntsToValue(&v, static_cast<unsigned int>(value & 0xffffffff), static_cast<int>(value >> 32));
+	XSyncSetCounter(get_xdisplay(), wnd->sync_counter, v);
+}
+
+#if defined(EDWIN_RANDR)
+static
+auto open_randr() -> bool {
 	const auto xdisplay = get_xdisplay();
-	if (!xdisplay) {
-		return nullptr;
+	int event_base, error_base, major, minor;
+	if (!XRRQueryExtension(xdisplay, &event_base, &error_base)) {
+		return false;
 	}
-	const auto screen = DefaultScreen(xdisplay);
-	const auto parent = cfg.parent.value ? (Window)(cfg.parent.value) : RootWindow(xdisplay, screen);
-	const auto visual = DefaultVisual(xdisplay, screen);
-	const auto depth = DefaultDepth(xdisplay, screen);
-	const auto border_width = 0;
-	wnd->xwindow = XCreateSimpleWindow(xdisplay, parent, cfg.position.x, cfg.position.y, cfg.size.width, cfg.size.height, border_width, BlackPixel(xdisplay, screen), WhitePixel(xdisplay, screen));
-	if (!wnd->xwindow) {
-		return nullptr;
+	// GetScreenResourcesCurrent is new in 1.3, and the server only sends
+	// CRTC changes to clients which asked for at least 1.2.
+	if (!XRRQueryVersion(xdisplay, &major, &minor) || major < 1 || (major == 1 && minor < 3)) {
+		return false;
 	}
-	wnd->size = cfg.size;
-	window_list_.push_back({wnd->xwindow, wnd.get()});
-	set(wnd.get(), cfg.on_closed);
-	set(wnd.get(), cfg.on_resized);
-	set(wnd.get(), cfg.on_resizing);
-	set(wnd.get(), cfg.icon);
-	set(wnd.get(), cfg.resizable);
-	set(wnd.get(), cfg.title);
-	set(wnd.get(), cfg.visible);
-	return wnd.release();
+	randr_event_base_ = event_base;
+	XRRSelectInput(xdisplay, DefaultRootWindow(xdisplay), RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask);
+	return true;
 }
 
-auto destroy(window* wnd) -> void {
+// One round trip for the resources and one per CRTC.
+static
+auto query_randr_crtcs(std::vector<crtc>* crtcs) -> void {
+	const auto xdisplay = get_xdisplay();
+	const auto resources = XRRGetScreenResourcesCurrent(xdisplay, DefaultRootWindow(xdisplay));
+	if (!resources) {
+		return;
+	}
+	for (auto i = 0; i < resources->ncrtc; i++) {
+		const auto info = XRRGetCrtcInfo(xdisplay, resources, resources->crtcs[i]);
+		if (!info) {
+			continue;
+		}
+		// Mode 0 isn't driving anything.
+		for (auto m = 0; info->mode && m < resources->nmode; m++) {
+			const auto& mode = resources->modes[m];
+			if (mode.id != info->mode) {
+				continue;
+			}
+			const auto period = get_refresh_period(mode.dotClock, mode.hTotal, mode.vTotal, mode.modeFlags & RR_DoubleScan, mode.modeFlags & RR_Interlace);
+			if (period.count() > 0) {
+				crtcs->push_back({{info->x, info->y, int(info->width), int(info->height)}, period});
+			}
+			break;
+		}
+		XRRFreeCrtcInfo(info);
+	}
+	XRRFreeScreenResources(resources);
+}
+#else
+static
+auto open_randr() -> bool {
+	return false;
+}
+
+static
+auto query_randr_crtcs(std::vector<crtc>*) -> void {}
+#endif
+
+static
+auto is_randr_event(const XEvent& event) -> bool {
+	return randr_event_base_ >= 0 && (event.type == randr_event_base_ || event.type == randr_event_base_ + 1);
+}
+
+auto destroy(window* ref) -> void {
+	const auto wnd = get_window(ref);
 	if (!wnd) { return; }
-	if (!wnd->xwindow) { return; }
 	const auto xdisplay = get_xdisplay();
 	if (!xdisplay) { return; }
-	auto match = [wnd](const entry& e) { return e.wnd == wnd; };
-	window_list_.erase(std::remove_if(window_list_.begin(), window_list_.end(), match), window_list_.end());
+	if (wnd->sync_counter) {
+		XSyncDestroyCounter(xdisplay, wnd->sync_counter);
+	}
 	XDestroyWindow(xdisplay, wnd->xwindow);
-	delete wnd;
+	remove_window(wnd);
 }
 
 auto get_native_handle(const window& w) -> native_handle {
-	return native_handle{(void*)(w.xwindow)};
+	const auto wnd = get_window(&w);
+	return native_handle{wnd ? (void*)(wnd->xwindow) : nullptr};
 }
 
 auto get_xwindow(const window& w) -> Window {
-	return w.xwindow;
+	const auto wnd = get_window(&w);
+	return wnd ? wnd->xwindow : 0;
 }
 
-auto set(window* wnd, edwin::icon icon) -> void {
+static icon_cache<unsigned long> icon_cache_;
+
+static
+auto write_icons(window* wnd, std::span<const edwin::icon> icons) -> void {
 	// I don't know if this code works because my window
 	// manager doesn't actually have window icons.
-	if (icon.size.width <= 0 || icon.size.height <= 0) {
-		return;
+	static std::vector<edwin::icon> valid;
+	valid.clear();
+	for (const auto& icon : icons) {
+		if (is_valid(icon)) {
+			valid.push_back(icon);
+		}
 	}
-	std::vector<unsigned long> icon_data;
-	icon_data.resize(2 + (icon.size.width * icon.size.height));
-	icon_data[0] = icon.size.width;
-	icon_data[1] = icon.size.height;
-	for (size_t i = 0; i < icon.pixels.size(); ++i) {
-		long unsigned int value = 0;
-		value |= (long unsigned int)(icon.pixels[i].a); value <<= 8;
-		value |= (long unsigned int)(icon.pixels[i].r); value <<= 8;
-		value |= (long unsigned int)(icon.pixels[i].g); value <<= 8;
-		value |= (long unsigned int)(icon.pixels[i].b);
-		icon_data[i + 2] = value;
+	if (valid.empty()) {
+		return;
 	}
-	const auto xdisplay = get_xdisplay();
-	const auto property = XInternAtom(xdisplay, "_NET_WM_ICON", False);
-	XChangeProperty(xdisplay, wnd->xwindow, property, XA_CARDINAL, 32, PropModeReplace, reinterpret_cast<const unsigned char*>(icon_data.data()), icon_data.size());
+	const auto& icon_data = icon_cache_.get(valid);
+	XChangeProperty(get_xdisplay(), wnd->xwindow, get_atom(atom::net_wm_icon), XA_CARDINAL, 32, PropModeReplace, reinterpret_cast<const unsigned char*>(icon_data.data()), static_cast<int>(icon_data.size()));
 }
 
-auto set(window* wnd, edwin::position position) -> void {
-	XMoveWindow(get_xdisplay(), wnd->xwindow, position.x, position.y);
-}
-
-auto set(window* wnd, edwin::position position, edwin::size size) -> void {
-	wnd->size = size;
-	XMoveResizeWindow(get_xdisplay(), wnd->xwindow, position.x, position.y, size.width, size.height);
-	set(wnd, wnd->resizable);
-}
-
-auto set(window* wnd, edwin::resizable resizable) -> void {
-	XSizeHints hints = {0};
+static
+auto write_size_hints(window* wnd) -> void {
+	XSizeHints hints = {};
 	hints.flags = PMinSize | PMaxSize;
-	if (resizable.value) {
+	if (wnd->resizable.value) {
 		hints.min_width  = MIN_SIZE;
 		hints.min_height = MIN_SIZE;
 		hints.max_width  = MAX_SIZE;
@@ -141,80 +239,633 @@ auto set(window* wnd, edwin::resizable resizable) -> void {
 	XSetWMNormalHints(get_xdisplay(), wnd->xwindow, &hints);
 }
 
-auto set(window* wnd, edwin::size size) -> void {
+static
+auto write_title(window* wnd, edwin::title title) -> void {
+	const auto xdisplay = get_xdisplay();
+	const auto data = reinterpret_cast<const unsigned char*>(title.value.data());
+	const auto length = static_cast<int>(title.value.size());
+	XChangeProperty(xdisplay, wnd->xwindow, XA_WM_NAME, XA_STRING, 8, PropModeReplace, data, length);
+	XChangeProperty(xdisplay, wnd->xwindow, get_atom(atom::net_wm_name), get_atom(atom::utf8_string), 8, PropModeReplace, data, length);
+}
+
+static
+auto write_visible(window* wnd, edwin::visible visible) -> void {
+	const auto xdisplay = get_xdisplay();
+	if (visible.value) { XMapWindow(xdisplay, wnd->xwindow); }
+	// Withdrawn properly (ICCCM 4.1.4) so that the window manager treats the
+	// next map as a new window, e.g. when it comes back out of a pool.
+	else               { XWithdrawWindow(xdisplay, wnd->xwindow, DefaultScreen(xdisplay)); }
+}
+
+// Everything create() does except flushing the connection, so that
+// create_many() can flush once for all of the windows.
+static
+auto create_window(window_config cfg) -> window* {
+	const auto xdisplay = get_xdisplay();
+	const auto screen = DefaultScreen(xdisplay);
+	const auto parent = cfg.parent.value ? (Window)(cfg.parent.value) : RootWindow(xdisplay, screen);
+	const auto border_width = 0;
+	// Same defaults as XCreateSimpleWindow(), and the event mask is set
+	// here rather than with a separate XSelectInput().
+	auto attributes = XSetWindowAttributes{};
+	attributes.background_pixel = WhitePixel(xdisplay, screen);
+	attributes.border_pixel     = BlackPixel(xdisplay, screen);
+	attributes.event_mask       = StructureNotifyMask | ExposureMask | INPUT_EVENT_MASK;
+	const auto mask = CWBackPixel | CWBorderPixel | CWEventMask;
+	const auto xwindow = XCreateWindow(xdisplay, parent, cfg.position.x, cfg.position.y, cfg.size.width, cfg.size.height, border_width,
+		CopyFromParent, InputOutput, CopyFromParent, mask, &attributes);
+	if (!xwindow) {
+		return nullptr;
+	}
+	const auto wnd = add_window(xwindow, cfg);
+	if (!wnd) {
+		XDestroyWindow(xdisplay, xwindow);
+		return nullptr;
+	}
+	const auto ref = get_ref(wnd);
+	write_protocols(wnd);
+	set(ref, std::move(cfg.on_closed));
+	set(ref, std::move(cfg.on_damaged));
+	set(ref, std::move(cfg.on_resized));
+	set(ref, std::move(cfg.on_resizing));
+	set(ref, std::move(cfg.on_key));
+	set(ref, std::move(cfg.on_mouse_button));
+	set(ref, std::move(cfg.on_mouse_move));
+	set(ref, std::move(cfg.on_mouse_wheel));
+	set(ref, cfg.compress_motion);
+	set(ref, cfg.resize_settle);
+	set(ref, cfg.resize_sync);
+	// The position and size were set by XCreateWindow().
+	wnd->resizable = cfg.resizable;
+	write_size_hints(wnd);
+	write_title(wnd, cfg.title);
+	if (cfg.icons.value.empty()) { write_icons(wnd, {&cfg.icon, 1}); }
+	else                         { write_icons(wnd, cfg.icons.value); }
+	if (cfg.visible.value) {
+		// Mapped last so that the window manager sees the final
+		// properties when the window first appears. A new window is
+		// already unmapped, so there's nothing to withdraw otherwise.
+		write_visible(wnd, cfg.visible);
+	}
+	return ref;
+}
+
+auto create(window_config cfg) -> window* {
+	const auto xdisplay = get_xdisplay();
+	if (!xdisplay) {
+		return nullptr;
+	}
+	const auto scope = traced{trace_scope::create};
+	const auto wnd = create_window(std::move(cfg));
+	XFlush(xdisplay);
+	return wnd;
+}
+
+auto create_many(std::span<window_config> cfgs) -> std::vector<window*> {
+	auto windows = std::vector<window*>(cfgs.size());
+	const auto xdisplay = get_xdisplay();
+	if (!xdisplay) {
+		return windows;
+	}
+	const auto scope = traced{trace_scope::create};
+	for (size_t i = 0; i < cfgs.size(); i++) {
+		windows[i] = create_window(std::move(cfgs[i]));
+	}
+	XFlush(xdisplay);
+	return windows;
+}
+
+auto set(window* ref, edwin::icon icon) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_icons(wnd, {&icon, 1});
+}
+
+auto set(window* ref, edwin::icons icons) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_icons(wnd, icons.value);
+}
+
+auto set(window* ref, edwin::position position) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	XMoveWindow(get_xdisplay(), wnd->xwindow, position.x, position.y);
+}
+
+auto set(window* ref, edwin::position position, edwin::size size) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
 	wnd->size = size;
+	write_size_hints(wnd);
+	XMoveResizeWindow(get_xdisplay(), wnd->xwindow, position.x, position.y, size.width, size.height);
+}
+
+auto set(window* ref, edwin::resizable resizable) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->resizable = resizable;
+	write_size_hints(wnd);
+}
+
+auto set(window* ref, edwin::resize_settle settle) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->resize_settle = settle;
+}
+
+auto set(window* ref, edwin::resize_sync sync) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->resize_sync = sync;
+}
+
+auto set(window* ref, edwin::size size) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->size = size;
+	write_size_hints(wnd);
 	XResizeWindow(get_xdisplay(), wnd->xwindow, size.width, size.height);
-	set(wnd, wnd->resizable);
 }
 
-auto set(window* wnd, edwin::title title) -> void {
-	XStoreName(get_xdisplay(), wnd->xwindow, title.value.data());
+auto set(window* ref, edwin::title title) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_title(wnd, title);
+}
+
+auto set(window* ref, edwin::visible visible) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_visible(wnd, visible);
+}
+
+auto set(window* ref, fn::on_window_closed cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_closed = std::move(cb);
+}
+
+auto set(window* ref, fn::on_window_damaged cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_damaged = std::move(cb);
+}
+
+auto set(window* ref, fn::on_window_resized cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_resized = std::move(cb);
+}
+
+auto set(window* ref, fn::on_window_resizing cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_resizing = std::move(cb);
+}
+
+auto set(window* ref, edwin::compress_motion compress) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->compress_motion = compress;
+}
+
+auto set(window* ref, fn::on_key cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_key = std::move(cb);
 }
 
-auto set(window* wnd, edwin::visible visible) -> void {
-	if (visible.value) { XMapWindow(get_xdisplay(), wnd->xwindow); }
-	else               { XUnmapWindow(get_xdisplay(), wnd->xwindow); }
+auto set(window* ref, fn::on_mouse_button cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_mouse_button = std::move(cb);
 }
 
-auto set(window* wnd, fn::on_window_closed cb) -> void {
-	wnd->on_closed = cb;
+auto set(window* ref, fn::on_mouse_move cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_mouse_move = std::move(cb);
 }
 
-auto set(window* wnd, fn::on_window_resized cb) -> void {
-	wnd->on_resized = cb;
+auto set(window* ref, fn::on_mouse_wheel cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_mouse_wheel = std::move(cb);
 }
 
-auto set(window* wnd, fn::on_window_resizing cb) -> void {
-	wnd->on_resizing = cb;
+auto batch::commit() -> void {
+	if (const auto wnd = get_window(wnd_)) {
+		const auto xdisplay = get_xdisplay();
+		if (resizable_) { wnd->resizable = *resizable_; }
+		if (size_)      { wnd->size = *size_; }
+		if (resizable_ || size_) {
+			// Written once even if both changed.
+			write_size_hints(wnd);
+		}
+		if (position_ || size_) {
+			XWindowChanges changes = {};
+			auto mask = 0u;
+			if (position_) {
+				changes.x = position_->x;
+				changes.y = position_->y;
+				mask |= CWX | CWY;
+			}
+			if (size_) {
+				changes.width  = size_->width;
+				changes.height = size_->height;
+				mask |= CWWidth | CWHeight;
+			}
+			XConfigureWindow(xdisplay, wnd->xwindow, mask, &changes);
+		}
+		if (title_) { write_title(wnd, *title_); }
+		if (icon_)  { write_icons(wnd, {&*icon_, 1}); }
+		if (icons_) { write_icons(wnd, icons_->value); }
+		if (visible_) {
+			// Mapped last so that the window manager sees the final
+			// properties when the window first appears.
+			write_visible(wnd, *visible_);
+		}
+		XFlush(xdisplay);
+	}
+	*this = batch{wnd_};
 }
 
+struct surface_image {
+	XImage* ximage = nullptr;
+	XShmSegmentInfo shm = {};
+	// Serial of the last XShmPutImage reading from the image, or 0 if the
+	// server is done with it.
+	unsigned long serial = 0;
+};
+
+struct surface {
+	handle wnd;
+	GC gc = nullptr;
+	surface_pixels pixels;
+	bool shm = false;
+	// Two images with MIT-SHM so one can be written while the server reads
+	// the other. Just the first one otherwise.
+	surface_image images[2];
+	int back = 0;
+};
+
+static std::vector<surface*> surfaces_;
+
 static
-auto on_notify_configure(const XConfigureEvent& event) -> void {
-	if (const auto wnd = get_window(event.window)) {
-		if (wnd->on_resizing.fn) {
-			wnd->on_resizing.fn(size{event.width, event.height});
+auto create_shm_image(surface_image* image, edwin::size size) -> bool {
+	const auto xdisplay = get_xdisplay();
+	const auto screen = DefaultScreen(xdisplay);
+	image->ximage = XShmCreateImage(xdisplay, DefaultVisual(xdisplay, screen), DefaultDepth(xdisplay, screen), ZPixmap, nullptr, &image->shm, size.width, size.height);
+	if (!image->ximage) {
+		return false;
+	}
+	const auto fail = [image] {
+		image->ximage->data = nullptr;
+		XDestroyImage(image->ximage);
+		*image = {};
+		return false;
+	};
+	image->shm.shmid = shmget(IPC_PRIVATE, size_t(image->ximage->bytes_per_line) * size_t(size.height), IPC_CREAT | 0600);
+	if (image->shm.shmid < 0) {
+		return fail();
+	}
+	image->shm.shmaddr = static_cast<char*>(shmat(image->shm.shmid, nullptr, 0));
+	if (image->shm.shmaddr == reinterpret_cast<char*>(-1)) {
+		shmctl(image->shm.shmid, IPC_RMID, nullptr);
+		return fail();
+	}
+	image->ximage->data = image->shm.shmaddr;
+	image->shm.readOnly = False;
+	// Attaching fails if the server isn't on this machine, which is only
+	// reported asynchronously.
+	const auto mark = mark_x_errors();
+	shm_attach_serial_ = mark.serial;
+	const auto attached = XShmAttach(xdisplay, &image->shm);
+	XSync(xdisplay, False);
+	shm_attach_serial_ = 0;
+	// Only an error for the attach itself counts, not one for some other
+	// request which happened to be reported during the XSync().
+	auto error = x_error{};
+	const auto failed = check_x_errors(mark, &error) == x_error_status::failed && error.serial == mark.serial;
+	// Freed once both sides have detached, even if we crash.
+	shmctl(image->shm.shmid, IPC_RMID, nullptr);
+	if (!attached || failed) {
+		shmdt(image->shm.shmaddr);
+		return fail();
+	}
+	return true;
+}
+
+static
+auto create_image(surface_image* image, edwin::size size) -> bool {
+	const auto xdisplay = get_xdisplay();
+	const auto screen = DefaultScreen(xdisplay);
+	image->ximage = XCreateImage(xdisplay, DefaultVisual(xdisplay, screen), DefaultDepth(xdisplay, screen), ZPixmap, 0, nullptr, size.width, size.height, 32, 0);
+	if (!image->ximage) {
+		return false;
+	}
+	// Freed by XDestroyImage().
+	image->ximage->data = static_cast<char*>(std::malloc(size_t(image->ximage->bytes_per_line) * size_t(size.height)));
+	// Pixels are written in our byte order. Xlib swaps them if the server's is different.
+	image->ximage->byte_order = std::endian::native == std::endian::little ? LSBFirst : MSBFirst;
+	return image->ximage->data != nullptr;
+}
+
+static
+auto free_image(surface_image* image, bool shm) -> void {
+	if (!image->ximage) {
+		return;
+	}
+	if (shm) {
+		// The server keeps reading from its own mapping until it gets to
+		// the detach request, so there's no need to wait for it.
+		XShmDetach(get_xdisplay(), &image->shm);
+		shmdt(image->shm.shmaddr);
+		image->ximage->data = nullptr;
+	}
+	XDestroyImage(image->ximage);
+	*image = {};
+}
+
+static
+auto realloc_images(surface* surf) -> void {
+	for (auto& image : surf->images) {
+		free_image(&image, surf->shm);
+	}
+	surf->back = 0;
+	const auto size = surf->pixels.size;
+	if (size.width <= 0 || size.height <= 0) {
+		return;
+	}
+	surf->shm = shm_available_;
+	if (surf->shm) {
+		if (create_shm_image(&surf->images[0], size) && create_shm_image(&surf->images[1], size)) {
+			return;
 		}
+		// Don't bother trying again for other surfaces.
+		free_image(&surf->images[0], true);
+		shm_available_ = false;
+		surf->shm = false;
+	}
+	if (!create_image(&surf->images[0], size)) {
+		free_image(&surf->images[0], false);
 	}
 }
 
 static
-auto on_client_message(const XEvent& event) -> void {
-	if (const auto wnd = get_window(event.xany.window)) {
-		if (wnd->on_closed.fn) {
-			wnd->on_closed.fn();
+auto on_shm_completion(const XShmCompletionEvent& event) -> void {
+	for (const auto surf : surfaces_) {
+		for (auto& image : surf->images) {
+			if (image.serial && image.shm.shmseg == event.shmseg && event.serial >= image.serial) {
+				image.serial = 0;
+			}
 		}
-		destroy(wnd);
 	}
 }
 
-auto process_messages() -> void {
+auto create_surface(window* ref) -> surface* {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return nullptr; }
 	const auto xdisplay = get_xdisplay();
-	XEvent event;
-	while (XPending(xdisplay)) {
-		XNextEvent(xdisplay, &event);
-		switch (event.type) {
-			case ConfigureNotify: { on_notify_configure(event.xconfigure); break; }
-			case DestroyNotify:   { on_client_message(event); break; }
-			default:              { break; }
+	const auto visual = DefaultVisual(xdisplay, DefaultScreen(xdisplay));
+	if (visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff) {
+		// Only 24-bit TrueColor visuals are supported.
+		return nullptr;
+	}
+	const auto surf = new surface;
+	surf->wnd = get_handle(*wnd);
+	surf->gc  = XCreateGC(xdisplay, wnd->xwindow, 0, nullptr);
+	surfaces_.push_back(surf);
+	return surf;
+}
+
+auto destroy(surface* surf) -> void {
+	if (!surf) { return; }
+	for (auto& image : surf->images) {
+		free_image(&image, surf->shm);
+	}
+	XFreeGC(get_xdisplay(), surf->gc);
+	surfaces_.erase(std::remove(surfaces_.begin(), surfaces_.end(), surf), surfaces_.end());
+	delete surf;
+}
+
+auto acquire(surface* surf) -> std::span<rgba> {
+	const auto wnd = get_window(surf->wnd);
+	if (!wnd) { return {}; }
+	// Only reallocated when the coalesced size changes, not for every
+	// ConfigureNotify.
+	if (resize(&surf->pixels, wnd->size)) {
+		realloc_images(surf);
+	}
+	return surf->pixels.data;
+}
+
+auto get_size(const surface& surf) -> edwin::size {
+	return surf.pixels.size;
+}
+
+auto present(surface* surf, std::span<const rect> dirty) -> void {
+	const auto wnd = get_window(surf->wnd);
+	auto& image = surf->images[surf->back];
+	if (!wnd || !image.ximage) { return; }
+	const auto xdisplay = get_xdisplay();
+	if (image.serial) {
+		// The server hasn't finished reading the frame before last yet.
+		XSync(xdisplay, False);
+		image.serial = 0;
+	}
+	const auto stride = image.ximage->bytes_per_line / 4;
+	const auto data = reinterpret_cast<uint32_t*>(image.ximage->data);
+	for_each_dirty(surf->pixels, dirty, [&](rect r) {
+		convert(surf->pixels, r, data + ptrdiff_t(r.y) * stride + r.x, stride);
+		if (surf->shm) {
+			image.serial = NextRequest(xdisplay);
+			XShmPutImage(xdisplay, wnd->xwindow, surf->gc, image.ximage, r.x, r.y, r.x, r.y, r.width, r.height, True);
+		}
+		else {
+			XPutImage(xdisplay, wnd->xwindow, surf->gc, image.ximage, r.x, r.y, r.x, r.y, r.width, r.height);
 		}
+	});
+	if (surf->shm) {
+		surf->back ^= 1;
 	}
+	XFlush(xdisplay);
 }
 
-auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval) -> void {
-	app_frame_ = frame;
-	app_schedule_stop_ = false;
-	auto next_frame = std::chrono::steady_clock::now();
-	for (;;) {
-		process_messages();
-		if (frame.fn) {
-			frame.fn();
+static
+auto handle_event(const XEvent& event) -> void {
+	if (tracing_) {
+		trace_event(get_ref(get_window(event.xany.window)), event.type);
+	}
+	switch (event.type) {
+		case ConfigureNotify: {
+			const auto& e = event.xconfigure;
+			on_notify_configure(e.window, {e.x, e.y}, {e.width, e.height}, e.send_event != False);
+			break;
 		}
-		if (app_schedule_stop_) {
-			return;
+		case ReparentNotify:  { on_notify_reparent(event.xreparent.window, event.xreparent.parent == DefaultRootWindow(get_xdisplay())); break; }
+		case DestroyNotify:   { on_notify_destroy(event.xdestroywindow.window); break; }
+		case Expose:          { on_notify_expose(event.xexpose.window, {event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height}, event.xexpose.count); break; }
+		case MappingNotify:   { auto e = event.xmapping; XRefreshKeyboardMapping(&e); break; }
+		case ClientMessage: {
+			const auto& e = event.xclient;
+			if (e.message_type != get_atom(atom::wm_protocols) || e.format != 32) {
+				break;
+			}
+			const auto protocol = static_cast<Atom>(e.data.l[0]);
+			if (protocol == get_atom(atom::wm_delete_window)) {
+				on_notify_destroy(e.window);
+			}
+			else if (protocol == get_atom(atom::net_wm_sync_request)) {
+				const auto lo = static_cast<uint64_t>(static_cast<uint32_t>(e.data.l[2]));
+				const auto hi = static_cast<uint64_t>(static_cast<uint32_t>(e.data.l[3]));
+				on_sync_request(e.window, static_cast<int64_t>(lo | (hi << 32)));
+			}
+			break;
+		}
+		case MotionNotify: {
+			const auto& e = event.xmotion;
+			on_input_motion(e.window, {{e.x, e.y}, get_modifiers(e.state), make_input_time(e.time)});
+			break;
+		}
+		case ButtonPress:
+		case ButtonRelease: {
+			const auto& e = event.xbutton;
+			on_input_button(e.window, e.button, e.type == ButtonPress, {e.x, e.y}, get_modifiers(e.state), make_input_time(e.time));
+			break;
+		}
+		case KeyPress:
+		case KeyRelease: {
+			auto e = event.xkey;
+			const auto keysym = static_cast<uint32_t>(XLookupKeysym(&e, 0));
+			on_input_key(e.window, {e.keycode, keysym, e.type == KeyPress, get_modifiers(e.state), make_input_time(e.time)});
+			break;
 		}
-		next_frame += interval.value;
-		std::this_thread::sleep_until(next_frame);
+		default: {
+			if (event.type == shm_completion_) {
+				on_shm_completion(reinterpret_cast<const XShmCompletionEvent&>(event));
+			}
+			else if (is_randr_event(event)) {
+#if defined(EDWIN_RANDR)
+				// Xlib wants to hear about the new screen size from
+				// whoever reads the event.
+				auto e = event;
+				XRRUpdateConfiguration(&e);
+#endif
+				on_notify_screen_change();
+			}
+			break;
+		}
+	}
+}
+
+// With a shared connection the host's events stay in the queue for the
+// host. Everything edwin needs to see is addressed to one of its windows,
+// including MIT-SHM completions. Only what Xlib has already queued is
+// looked at, because reading the connection here would leave the host's
+// events in the queue where its poll() on the fd never sees them.
+static
+auto process_queued_own_events(Display* xdisplay) -> void {
+	// Not static, a callback may call process_messages() again.
+	auto foreign = std::vector<XEvent>{};
+	auto count = XEventsQueued(xdisplay, QueuedAlready);
+	XEvent event;
+	// Checked again each time in case a callback drained the queue, since
+	// XNextEvent() would then block on the connection.
+	while (count-- > 0 && XEventsQueued(xdisplay, QueuedAlready) > 0) {
+		XNextEvent(xdisplay, &event);
+		if (get_window(event.xany.window)) { handle_event(event); }
+		else                               { foreign.push_back(event); }
+		// RandR events go to the root window, and the host reads them.
+		if (is_randr_event(event)) { on_notify_screen_change(); }
+	}
+	// XPutBackEvent() pushes to the front, so backwards keeps the order.
+	for (auto i = foreign.rbegin(); i != foreign.rend(); i++) {
+		XPutBackEvent(xdisplay, &*i);
+	}
+}
+
+auto process_messages() -> void {
+	const auto xdisplay = get_xdisplay();
+	if (!xdisplay) {
+		return;
+	}
+	const auto scope = traced{trace_scope::dispatch};
+	const auto was_dispatching = dispatch_beg();
+	if (xdisplay_shared_) {
+		process_queued_own_events(xdisplay);
 	}
+	else {
+		XEvent event;
+		while (XPending(xdisplay)) {
+			XNextEvent(xdisplay, &event);
+			handle_event(event);
+		}
+	}
+	dispatch_end(was_dispatching);
+}
+
+auto dispatch(const XEvent& event) -> bool {
+	if (is_randr_event(event)) {
+		// Noticed, but it's still the host's.
+		on_notify_screen_change();
+		return false;
+	}
+	if (!get_window(event.xany.window)) {
+		return false;
+	}
+	const auto scope = traced{trace_scope::dispatch};
+	const auto was_dispatching = dispatch_beg();
+	handle_event(event);
+	dispatch_end(was_dispatching);
+	return true;
+}
+
+auto mark_x_errors() -> x_error_mark {
+	const auto xdisplay = get_xdisplay();
+	if (!xdisplay) {
+		return {};
+	}
+	return {NextRequest(xdisplay)};
+}
+
+auto check_x_errors(x_error_mark since, x_error* first) -> x_error_status {
+	const auto xdisplay = get_xdisplay();
+	if (!xdisplay) {
+		return x_error_status::none;
+	}
+	return check_x_errors(since, NextRequest(xdisplay) - 1, LastKnownRequestProcessed(xdisplay), first);
+}
+
+auto resize_done(window* ref) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	ack_sync(wnd);
+	XFlush(get_xdisplay());
+}
+
+static
+auto get_connection_fd() -> int {
+	const auto xdisplay = get_xdisplay();
+	return xdisplay ? ConnectionNumber(xdisplay) : -1;
+}
+
+static
+auto prepare_wait() -> bool {
+	const auto xdisplay = get_xdisplay();
+	XFlush(xdisplay);
+	if (xdisplay_shared_) {
+		// Whatever is queued is the host's business.
+		return false;
+	}
+	// Xlib may already have read some events off the socket, in which
+	// case the fd won't become readable for them.
+	return XEventsQueued(xdisplay, QueuedAlready) > 0;
+}
+
+auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	run_app(std::move(frame), interval, overrun);
 }
 
 auto app_end() -> void {
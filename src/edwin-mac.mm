@@ -1,59 +1,173 @@
 #include "edwin.hpp"
+#include "edwin-frame.hpp"
+#include "edwin-surface.hpp"
 #include <algorithm>
 #include <Cocoa/Cocoa.h>
 #include <memory>
 #include <thread>
+#include <unordered_set>
 
 @interface EdwinWindow : NSWindow
 @property (nonatomic, readwrite) edwin::window* wnd;
 @end
 
+@interface EdwinView : NSView
+@property (nonatomic, readwrite) edwin::window* wnd;
+@end
+
 namespace edwin {
 
 struct window {
 	EdwinWindow* nswindow = nullptr;
 	NSView* nsview        = nullptr;
 	fn::on_window_closed on_window_closed;
+	fn::on_window_damaged on_window_damaged;
 	fn::on_window_resized on_window_resized;
 	fn::on_window_resizing on_window_resizing;
+	fn::on_key on_key;
+	fn::on_mouse_button on_mouse_button;
+	fn::on_mouse_move on_mouse_move;
+	fn::on_mouse_wheel on_mouse_wheel;
+	// frame_serial is bumped by set(window*, fn::frame, ...), so a frame
+	// callback which replaced itself isn't put back. While frame_depth is
+	// non-zero destroy() leaves deleting the window to run_window_frame().
+	fn::frame on_frame;
+	NSTimer* frame_timer = nullptr;
+	uint32_t frame_serial = 0;
+	int frame_depth = 0;
+	bool destroyed = false;
 };
 
+// Windows which haven't been destroyed. Only touched on the main thread.
+static std::unordered_set<window*> live_windows_;
+static fn::frame app_frame_;
+static frame_ticker app_frames_;
+
+static
+auto get_modifiers(NSEvent* event) -> key_modifiers {
+	const auto flags = [event modifierFlags];
+	return {
+		.shift = (flags & NSEventModifierFlagShift) != 0,
+		.ctrl  = (flags & NSEventModifierFlagControl) != 0,
+		.alt   = (flags & NSEventModifierFlagOption) != 0,
+		.super = (flags & NSEventModifierFlagCommand) != 0,
+	};
+}
+
+static
+auto make_input_time(NSEvent* event) -> input_time {
+	return {static_cast<uint32_t>(static_cast<uint64_t>([event timestamp] * 1000.0)), std::chrono::steady_clock::now()};
+}
+
+static
+auto get_position(NSView* view, NSEvent* event) -> position {
+	const auto p = [view convertPoint: [event locationInWindow] fromView: nil];
+	const auto y = [view isFlipped] ? p.y : [view bounds].size.height - p.y;
+	return {int(p.x), int(y)};
+}
+
+static
+auto get_button(NSEvent* event) -> mouse_button {
+	switch ([event buttonNumber]) {
+		case 0:  { return mouse_button::left; }
+		case 1:  { return mouse_button::right; }
+		case 2:  { return mouse_button::middle; }
+		case 3:  { return mouse_button::back; }
+		default: { return mouse_button::forward; }
+	}
+}
+
 } // edwin
 
 @implementation EdwinWindow
 - (void) windowDidResize: (NSNotification*) notification {
 	NSRect frame = [self frame];
-	if (self.wnd->on_window_resized.fn) {
-		const auto w = (int)(frame.size.width);
-		const auto h = (int)(frame.size.height);
-		self.wnd->on_window_resized.fn({w, h});
-	}
+	const auto w = (int)(frame.size.width);
+	const auto h = (int)(frame.size.height);
+	edwin::invoke(edwin::trace_scope::on_resized, self.wnd, self.wnd->on_window_resized.fn, edwin::size{w, h});
+	edwin::resume_resized(self.wnd, edwin::size{w, h});
 }
 - (void) windowWillResize: (NSWindow*) sender toSize: (NSSize) frameSize {
-	if (self.wnd->on_window_resizing.fn) {
-		const auto w = (int)(frameSize.width);
-		const auto h = (int)(frameSize.height);
-		self.wnd->on_window_resizing.fn({w, h});
-	}
+	const auto w = (int)(frameSize.width);
+	const auto h = (int)(frameSize.height);
+	edwin::invoke(edwin::trace_scope::on_resizing, self.wnd, self.wnd->on_window_resizing.fn, edwin::size{w, h});
 }
 - (void) windowWillClose: (NSNotification*) notification {
-	if (self.wnd->on_window_closed.fn) {
-		self.wnd->on_window_closed.fn();
+	edwin::invoke(edwin::trace_scope::on_closed, self.wnd, self.wnd->on_window_closed.fn);
+}
+@end
+
+@implementation EdwinView
+- (void) drawRect: (NSRect) dirtyRect {
+	if (!self.wnd || !self.wnd->on_window_damaged.fn) {
+		return;
 	}
+	static std::vector<edwin::rect> rects;
+	rects.clear();
+	const NSRect* drawn = nullptr;
+	NSInteger count = 0;
+	[self getRectsBeingDrawn: &drawn count: &count];
+	// edwin's rects have their origin at the top left.
+	const auto height = [self isFlipped] ? 0.0 : [self bounds].size.height;
+	for (NSInteger i = 0; i < count; i++) {
+		const auto r = drawn[i];
+		const auto y = [self isFlipped] ? r.origin.y : height - (r.origin.y + r.size.height);
+		rects.push_back({int(r.origin.x), int(y), int(r.size.width), int(r.size.height)});
+	}
+	edwin::invoke(edwin::trace_scope::on_damaged, self.wnd, self.wnd->on_window_damaged.fn, std::span<const edwin::rect>{rects});
+}
+- (BOOL) acceptsFirstResponder {
+	return YES;
+}
+- (void) edwinButton: (NSEvent*) event pressed: (bool) pressed {
+	if (!self.wnd) { return; }
+	const auto e = edwin::mouse_button_event{edwin::get_button(event), pressed, edwin::get_position(self, event), edwin::get_modifiers(event), edwin::make_input_time(event)};
+	edwin::invoke(edwin::trace_scope::on_mouse_button, self.wnd, self.wnd->on_mouse_button.fn, e);
+}
+- (void) edwinMove: (NSEvent*) event {
+	if (!self.wnd) { return; }
+	const auto e = edwin::mouse_move_event{edwin::get_position(self, event), edwin::get_modifiers(event), edwin::make_input_time(event)};
+	edwin::invoke(edwin::trace_scope::on_mouse_move, self.wnd, self.wnd->on_mouse_move.fn, e);
+}
+- (void) edwinKey: (NSEvent*) event pressed: (bool) pressed {
+	if (!self.wnd) { return; }
+	const auto code = static_cast<uint32_t>([event keyCode]);
+	const auto e = edwin::key_event{code, code, pressed, edwin::get_modifiers(event), edwin::make_input_time(event)};
+	edwin::invoke(edwin::trace_scope::on_key, self.wnd, self.wnd->on_key.fn, e);
+}
+- (void) mouseDown: (NSEvent*) event         { [self edwinButton: event pressed: true]; }
+- (void) mouseUp: (NSEvent*) event           { [self edwinButton: event pressed: false]; }
+- (void) rightMouseDown: (NSEvent*) event    { [self edwinButton: event pressed: true]; }
+- (void) rightMouseUp: (NSEvent*) event      { [self edwinButton: event pressed: false]; }
+- (void) otherMouseDown: (NSEvent*) event    { [self edwinButton: event pressed: true]; }
+- (void) otherMouseUp: (NSEvent*) event      { [self edwinButton: event pressed: false]; }
+- (void) mouseMoved: (NSEvent*) event        { [self edwinMove: event]; }
+- (void) mouseDragged: (NSEvent*) event      { [self edwinMove: event]; }
+- (void) rightMouseDragged: (NSEvent*) event { [self edwinMove: event]; }
+- (void) otherMouseDragged: (NSEvent*) event { [self edwinMove: event]; }
+- (void) keyDown: (NSEvent*) event           { [self edwinKey: event pressed: true]; }
+- (void) keyUp: (NSEvent*) event             { [self edwinKey: event pressed: false]; }
+- (void) scrollWheel: (NSEvent*) event {
+	if (!self.wnd) { return; }
+	// AppKit's positive x is to the left. Trackpads report pixels rather
+	// than notches, roughly ten per notch.
+	const auto scale = [event hasPreciseScrollingDeltas] ? 0.1f : 1.0f;
+	const auto dx = -static_cast<float>([event scrollingDeltaX]) * scale;
+	const auto dy = static_cast<float>([event scrollingDeltaY]) * scale;
+	const auto e = edwin::mouse_wheel_event{dx, dy, edwin::get_position(self, event), edwin::get_modifiers(event), edwin::make_input_time(event)};
+	edwin::invoke(edwin::trace_scope::on_mouse_wheel, self.wnd, self.wnd->on_mouse_wheel.fn, e);
 }
 @end
 
 @interface EdwinDelegate : NSObject <NSApplicationDelegate>
 @property (strong) NSTimer *timer;
-@property (nonatomic) edwin::fn::frame frame;
-@property (nonatomic) edwin::frame_interval frame_interval;
 @end
 
 @implementation EdwinDelegate
 - (void)applicationDidFinishLaunching:(NSNotification *)notification {
     [NSApp setActivationPolicy:NSApplicationActivationPolicyRegular];
 	self.timer = [NSTimer
-				  scheduledTimerWithTimeInterval: std::chrono::duration_cast<std::chrono::seconds>(self.frame_interval.value).count()
+				  scheduledTimerWithTimeInterval: std::chrono::duration<double>(edwin::app_frames_.interval).count()
 				  target:                         self
 				  selector:                       @selector(run_frame)
 				  userInfo:                       nil
@@ -64,15 +178,14 @@ struct window {
 	[self.timer invalidate];
 }
 - (void)run_frame {
-	if (self.frame.fn) {
-		self.frame.fn();
-	}
+	edwin::app_frames_.on_tick(edwin::app_frame_);
 }
 @end
 
 namespace edwin {
 
-auto create(window_config cfg) -> window* {
+static
+auto create_window(window_config cfg) -> window* {
 	auto wnd = std::make_unique<window>();
 	const auto rect = NSMakeRect(cfg.position.x, cfg.position.y, cfg.size.width, cfg.size.height);
 	wnd->nswindow = [[EdwinWindow alloc]
@@ -82,22 +195,60 @@ auto create(window_config cfg) -> window* {
 		defer:               NO
 	];
 	wnd->nswindow.wnd = wnd.get();
-	wnd->nsview       = [[NSView alloc] initWithFrame: rect];
+	const auto view   = [[EdwinView alloc] initWithFrame: rect];
+	view.wnd          = wnd.get();
+	wnd->nsview       = view;
 	[wnd->nswindow setContentView: wnd->nsview];
+	[wnd->nswindow setAcceptsMouseMovedEvents: YES];
+	[wnd->nswindow makeFirstResponder: wnd->nsview];
 	set(wnd.get(), cfg.title);
 	set(wnd.get(), cfg.resizable);
 	set(wnd.get(), cfg.visible);
-	set(wnd.get(), cfg.on_closed);
-	set(wnd.get(), cfg.on_resized);
-	set(wnd.get(), cfg.on_resizing);
+	set(wnd.get(), std::move(cfg.on_closed));
+	set(wnd.get(), std::move(cfg.on_damaged));
+	set(wnd.get(), std::move(cfg.on_key));
+	set(wnd.get(), std::move(cfg.on_mouse_button));
+	set(wnd.get(), std::move(cfg.on_mouse_move));
+	set(wnd.get(), std::move(cfg.on_mouse_wheel));
+	set(wnd.get(), std::move(cfg.on_resized));
+	set(wnd.get(), std::move(cfg.on_resizing));
+	live_windows_.insert(wnd.get());
 	return wnd.release();
 }
 
+auto create(window_config cfg) -> window* {
+	const auto scope = traced{trace_scope::create};
+	return create_window(std::move(cfg));
+}
+
+// Nothing to gain from creating them together here.
+auto create_many(std::span<window_config> cfgs) -> std::vector<window*> {
+	const auto scope = traced{trace_scope::create};
+	auto windows = std::vector<window*>(cfgs.size());
+	for (size_t i = 0; i < cfgs.size(); i++) {
+		windows[i] = create_window(std::move(cfgs[i]));
+	}
+	return windows;
+}
+
 auto destroy(window* wnd) -> void {
 	if (!wnd)          { return; }
+	// Already closed by a frame callback, and waiting to be deleted.
+	if (wnd->destroyed) { return; }
+	live_windows_.erase(wnd);
+	[wnd->frame_timer invalidate];
 	if (wnd->nswindow) { [wnd->nswindow close]; }
+	if (wnd->nsview)   { static_cast<EdwinView*>(wnd->nsview).wnd = nullptr; }
 	if (wnd->nsview)   { [wnd->nsview release]; }
+	if (wnd->frame_depth > 0) {
+		// Anything else the callback does with it goes to nil.
+		wnd->nswindow  = nullptr;
+		wnd->nsview    = nullptr;
+		wnd->destroyed = true;
+		return;
+	}
 	delete wnd;
+	resume_window_waiters(wnd);
 }
 
 auto get_native_handle(const window& wnd) -> native_handle {
@@ -116,6 +267,10 @@ auto set(window* wnd, edwin::icon icon) -> void {
 	// No-op on macOS.
 }
 
+auto set(window* wnd, edwin::icons icons) -> void {
+	// No-op on macOS.
+}
+
 auto set(window* wnd, edwin::position position) -> void {
 	auto frame = [wnd->nswindow frame];
 	frame.origin.x = position.x;
@@ -141,6 +296,14 @@ auto set(window* wnd, edwin::resizable resizable) -> void {
 	}
 }
 
+auto set(window* wnd, edwin::resize_settle settle) -> void {
+	// No-op on macOS. The platform tells us when the user has finished resizing.
+}
+
+auto set(window* wnd, edwin::resize_sync sync) -> void {
+	// No-op on macOS. Resizing is already synchronized with the application.
+}
+
 auto set(window* wnd, edwin::size size) -> void {
 	auto frame = [wnd->nswindow frame];
 	frame.origin.y += frame.size.height;
@@ -165,27 +328,199 @@ auto set(window* wnd, edwin::visible visible) -> void {
 }
 
 auto set(window* wnd, fn::on_window_closed cb) -> void {
-	wnd->on_window_closed = cb;
+	wnd->on_window_closed = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_window_damaged cb) -> void {
+	wnd->on_window_damaged = std::move(cb);
 }
 
 auto set(window* wnd, fn::on_window_resized cb) -> void {
-	wnd->on_window_resized = cb;
+	wnd->on_window_resized = std::move(cb);
 }
 
 auto set(window* wnd, fn::on_window_resizing cb) -> void {
-	wnd->on_window_resizing = cb;
+	wnd->on_window_resizing = std::move(cb);
+}
+
+auto set(window* wnd, edwin::compress_motion compress) -> void {
+	// macOS already coalesces mouse moves.
+}
+
+auto set(window* wnd, fn::on_key cb) -> void {
+	wnd->on_key = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_mouse_button cb) -> void {
+	wnd->on_mouse_button = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_mouse_move cb) -> void {
+	wnd->on_mouse_move = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_mouse_wheel cb) -> void {
+	wnd->on_mouse_wheel = std::move(cb);
+}
+
+auto batch::commit() -> void {
+	if (wnd_) {
+		if (resizable_)         { set(wnd_, *resizable_); }
+		if (position_ && size_) { set(wnd_, *position_, *size_); }
+		else if (position_)     { set(wnd_, *position_); }
+		else if (size_)         { set(wnd_, *size_); }
+		if (title_)             { set(wnd_, *title_); }
+		if (visible_)           { set(wnd_, *visible_); }
+	}
+	*this = batch{wnd_};
+}
+
+// Used by post(window*, ...), see edwin-post.hpp.
+static
+auto make_ref(window* wnd) -> window* {
+	return wnd;
+}
+
+static
+auto resolve(window* wnd) -> window* {
+	return live_windows_.contains(wnd) ? wnd : nullptr;
+}
+
+// Used by the awaiters, see edwin-await.hpp.
+static
+auto is_alive(window* wnd) -> bool {
+	return live_windows_.contains(wnd);
+}
+
+auto post(edwin::function<void()> fn) -> void {
+	// The main queue is serviced by the NSApplication run loop. Blocks
+	// can't capture move-only objects, so the function goes on the heap.
+	dispatch_async_f(dispatch_get_main_queue(), new edwin::function<void()>(std::move(fn)), [](void* context) {
+		const auto fn = static_cast<edwin::function<void()>*>(context);
+		(*fn)();
+		delete fn;
+	});
+}
+
+struct surface {
+	window* wnd = nullptr;
+	surface_pixels pixels;
+	std::vector<uint32_t> argb;
+};
+
+auto create_surface(window* wnd) -> surface* {
+	if (!live_windows_.count(wnd)) { return nullptr; }
+	[wnd->nsview setWantsLayer: YES];
+	const auto surf = new surface;
+	surf->wnd = wnd;
+	return surf;
+}
+
+auto destroy(surface* surf) -> void {
+	delete surf;
+}
+
+auto acquire(surface* surf) -> std::span<rgba> {
+	if (!live_windows_.count(surf->wnd)) { return {}; }
+	const auto bounds = [surf->wnd->nsview bounds];
+	if (resize(&surf->pixels, {int(bounds.size.width), int(bounds.size.height)})) {
+		surf->argb.assign(surf->pixels.data.size(), 0);
+	}
+	return surf->pixels.data;
+}
+
+auto get_size(const surface& surf) -> edwin::size {
+	return surf.pixels.size;
+}
+
+auto present(surface* surf, std::span<const rect> dirty) -> void {
+	if (!live_windows_.count(surf->wnd)) { return; }
+	const auto size = surf->pixels.size;
+	if (size.width <= 0 || size.height <= 0) { return; }
+	for_each_dirty(surf->pixels, dirty, [surf, size](rect r) {
+		convert(surf->pixels, r, surf->argb.data() + ptrdiff_t(r.y) * size.width + r.x, size.width);
+	});
+	// The layer needs a whole new image, so only the conversion benefits
+	// from the dirty rects.
+	const auto data       = CFDataCreate(nullptr, reinterpret_cast<const UInt8*>(surf->argb.data()), CFIndex(surf->argb.size() * 4));
+	const auto provider   = CGDataProviderCreateWithCFData(data);
+	const auto colorspace = CGColorSpaceCreateDeviceRGB();
+	const auto format     = static_cast<CGBitmapInfo>(uint32_t(kCGImageAlphaNoneSkipFirst) | uint32_t(kCGBitmapByteOrder32Little));
+	const auto image      = CGImageCreate(size.width, size.height, 8, 32, size_t(size.width) * 4, colorspace, format, provider, nullptr, false, kCGRenderingIntentDefault);
+	[[surf->wnd->nsview layer] setContents: (id)image];
+	CGImageRelease(image);
+	CGColorSpaceRelease(colorspace);
+	CGDataProviderRelease(provider);
+	CFRelease(data);
 }
 
 auto process_messages() -> void {
 	// No-op on macOS.
 }
 
-auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval) -> void {
+auto resize_done(window* wnd) -> void {
+	// No-op on macOS. There is no _NET_WM_SYNC_REQUEST to answer.
+}
+
+// For frame_interval::match_display. The refresh rate of the main screen,
+// or the given interval if macOS doesn't say (before macOS 12).
+static
+auto get_frame_period(edwin::frame_interval interval) -> std::chrono::nanoseconds {
+	if (interval.match_display) {
+		if (@available(macOS 12.0, *)) {
+			const auto fps = NSScreen.mainScreen.maximumFramesPerSecond;
+			if (fps > 0) {
+				return std::chrono::nanoseconds{1'000'000'000 / fps};
+			}
+		}
+	}
+	return interval.value;
+}
+
+static
+auto run_window_frame(window* wnd) -> void {
+	// Moved out for the call in case the callback replaces itself or
+	// destroys the window.
+	auto frame = std::move(wnd->on_frame);
+	const auto serial = wnd->frame_serial;
+	wnd->frame_depth++;
+	invoke(trace_scope::frame, wnd, frame.fn);
+	wnd->frame_depth--;
+	if (wnd->destroyed) {
+		if (wnd->frame_depth == 0) {
+			delete wnd;
+			resume_window_waiters(wnd);
+		}
+		return;
+	}
+	if (wnd->frame_serial == serial) {
+		wnd->on_frame = std::move(frame);
+	}
+}
+
+auto set(window* wnd, fn::frame cb, edwin::frame_interval interval) -> void {
+	// The run loop owns the timer, and lets go of it when it's invalidated.
+	[wnd->frame_timer invalidate];
+	wnd->frame_timer = nullptr;
+	wnd->on_frame    = std::move(cb);
+	wnd->frame_serial++;
+	if (!wnd->on_frame.fn) {
+		return;
+	}
+	wnd->frame_timer = [NSTimer
+		scheduledTimerWithTimeInterval: std::chrono::duration<double>(get_frame_period(interval)).count()
+		repeats:                        YES
+		block:                          ^(NSTimer*) { run_window_frame(wnd); }
+	];
+}
+
+auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	app_frame_ = std::move(frame);
+	app_frames_ = frame_ticker{get_frame_period(interval), overrun};
+	reset_frame_stats();
 	@autoreleasepool {
 		const auto app = [NSApplication sharedApplication];
 		const auto delegate = [[EdwinDelegate alloc] init];
-		delegate.frame = frame;
-		delegate.frame_interval = interval;
 		app.delegate = delegate;
 		[app run];
 	}
@@ -196,3 +531,6 @@ auto app_end() -> void {
 }
 
 } // edwin
+
+// Needs make_ref() and resolve() from above.
+#include "edwin-post.hpp"
@@ -0,0 +1,76 @@
+#pragma once
+
+// The post(window*, ...) functions, shared by all the backends. They are
+// written in terms of the backend's post(fn) and two functions which have
+// to be declared before this is included:
+//   make_ref(const window*) -> ref      Called on the posting thread.
+//   resolve(ref) -> window*             Called on the UI thread. Returns
+//                                       null if the window was destroyed.
+
+#include "edwin.hpp"
+#include <string>
+#include <vector>
+
+namespace edwin {
+
+template <typename... Args>
+static
+auto post_set(window* wnd, Args... args) -> void {
+	post([ref = make_ref(wnd), ...args = std::move(args)]() mutable {
+		if (const auto wnd = resolve(ref)) {
+			set(wnd, std::move(args)...);
+		}
+	});
+}
+
+auto post(window* wnd, edwin::icon icon) -> void {
+	post(wnd, edwin::icons{{&icon, 1}});
+}
+
+auto post(window* wnd, edwin::icons icons) -> void {
+	// The pixels belong to the caller.
+	auto sizes  = std::vector<edwin::size>{};
+	auto pixels = std::vector<std::vector<rgba>>{};
+	for (const auto& icon : icons.value) {
+		sizes.push_back(icon.size);
+		pixels.emplace_back(icon.pixels.begin(), icon.pixels.end());
+	}
+	post([ref = make_ref(wnd), sizes = std::move(sizes), pixels = std::move(pixels)]() mutable {
+		if (const auto wnd = resolve(ref)) {
+			auto list = std::vector<edwin::icon>{};
+			for (size_t i = 0; i < sizes.size(); i++) {
+				list.push_back({sizes[i], pixels[i]});
+			}
+			set(wnd, edwin::icons{list});
+		}
+	});
+}
+
+auto post(window* wnd, edwin::position position) -> void                     { post_set(wnd, position); }
+auto post(window* wnd, edwin::position position, edwin::size size) -> void   { post_set(wnd, position, size); }
+auto post(window* wnd, edwin::resizable resizable) -> void                   { post_set(wnd, resizable); }
+auto post(window* wnd, edwin::resize_settle settle) -> void                  { post_set(wnd, settle); }
+auto post(window* wnd, edwin::resize_sync sync) -> void                      { post_set(wnd, sync); }
+auto post(window* wnd, edwin::size size) -> void                             { post_set(wnd, size); }
+auto post(window* wnd, edwin::visible visible) -> void                       { post_set(wnd, visible); }
+auto post(window* wnd, fn::on_window_closed cb) -> void                      { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::on_window_damaged cb) -> void                     { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::on_window_resized cb) -> void                     { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::on_window_resizing cb) -> void                    { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, edwin::compress_motion compress) -> void              { post_set(wnd, compress); }
+auto post(window* wnd, fn::on_key cb) -> void                                { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::on_mouse_button cb) -> void                       { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::on_mouse_move cb) -> void                         { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::on_mouse_wheel cb) -> void                        { post_set(wnd, std::move(cb)); }
+auto post(window* wnd, fn::frame cb, edwin::frame_interval interval) -> void { post_set(wnd, std::move(cb), interval); }
+
+auto post(window* wnd, edwin::title title) -> void {
+	// The string belongs to the caller.
+	post([ref = make_ref(wnd), text = std::string{title.value}] {
+		if (const auto wnd = resolve(ref)) {
+			set(wnd, edwin::title{text});
+		}
+	});
+}
+
+} // edwin
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace edwin {
+
+// Lock-free multi-producer single-consumer queue (Dmitry Vyukov's
+// intrusive design). push() is wait-free and can be called from any
+// thread. pop() must only be called from one thread.
+template <typename T>
+struct mpsc_queue {
+	mpsc_queue() {
+		head_.store(&stub_);
+		tail_ = &stub_;
+	}
+	~mpsc_queue() {
+		T value;
+		while (pop(&value)) {}
+	}
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+	auto push(T value) -> void {
+		push(new node{std::move(value)});
+	}
+	// Returns false if the queue is empty, or if a producer is half way
+	// through a push, in which case the item shows up on a later call.
+	[[nodiscard]] auto pop(T* out) -> bool {
+		auto tail = tail_;
+		auto next = tail->next.load(std::memory_order_acquire);
+		if (tail == &stub_) {
+			if (!next) {
+				return false;
+			}
+			tail_ = next;
+			tail  = next;
+			next  = next->next.load(std::memory_order_acquire);
+		}
+		if (next) {
+			tail_ = next;
+			return take(tail, out);
+		}
+		if (tail != head_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		// tail is the last node. Put the stub back behind it so that it
+		// can be unlinked.
+		stub_.next.store(nullptr, std::memory_order_relaxed);
+		push(&stub_);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next) {
+			tail_ = next;
+			return take(tail, out);
+		}
+		return false;
+	}
+private:
+	struct node {
+		T value;
+		std::atomic<node*> next = nullptr;
+	};
+	auto push(node* n) -> void {
+		const auto prev = head_.exchange(n, std::memory_order_acq_rel);
+		prev->next.store(n, std::memory_order_release);
+	}
+	static auto take(node* n, T* out) -> bool {
+		*out = std::move(n->value);
+		delete n;
+		return true;
+	}
+	std::atomic<node*> head_;
+	node* tail_;
+	node stub_;
+};
+
+} // edwin
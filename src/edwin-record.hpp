@@ -0,0 +1,128 @@
+#pragma once
+
+// File format for record_events() and replay_events(). Events are stored
+// as they reach edwin's dispatch functions rather than as raw XEvents, so
+// a recording is about five times smaller and works with either Linux
+// backend.
+//
+// The file is a record_header followed by event_records in the order they
+// were dispatched. A record of kind dispatch marks the end of each
+// process_messages() call, so that replaying coalesces events the same
+// way.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace edwin {
+
+static constexpr char RECORD_MAGIC[8] = {'e', 'd', 'w', 'i', 'n', 'r', 'e', 'c'};
+static constexpr uint32_t RECORD_VERSION = 2;
+
+enum class record_kind : uint8_t {
+	dispatch,
+	configure,    // a, b = size, c, d = position
+	destroy,
+	expose,       // a, b, c, d = rect, e = count
+	sync_request, // a, b = low, high bits of the value
+	motion,       // a, b = position, e = server time
+	button,       // a, b = position, c = button, e = server time
+	key,          // a = keycode, b = keysym, e = server time
+};
+
+// Bits of event_record::flags.
+static constexpr uint8_t RECORD_SHIFT   = 1 << 0;
+static constexpr uint8_t RECORD_CTRL    = 1 << 1;
+static constexpr uint8_t RECORD_ALT     = 1 << 2;
+static constexpr uint8_t RECORD_SUPER   = 1 << 3;
+static constexpr uint8_t RECORD_PRESSED = 1 << 4;
+// The event came from SendEvent.
+static constexpr uint8_t RECORD_SYNTHETIC = 1 << 5;
+
+struct record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+struct event_record {
+	// Nanoseconds since recording started.
+	uint64_t time = 0;
+	// Windows are numbered in the order they were created, starting from
+	// the oldest one which was open when recording started.
+	uint32_t window = 0;
+	record_kind kind = record_kind::dispatch;
+	uint8_t flags = 0;
+	uint16_t reserved = 0;
+	int32_t a = 0, b = 0, c = 0, d = 0;
+	uint32_t e = 0;
+};
+
+// Records are written out in blocks, at the end of each dispatch.
+struct event_recorder {
+	auto open(const char* path) -> bool {
+		close();
+		file_ = std::fopen(path, "wb");
+		if (!file_) {
+			return false;
+		}
+		record_header header;
+		std::memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+		header.version     = RECORD_VERSION;
+		header.record_size = sizeof(event_record);
+		std::fwrite(&header, sizeof(header), 1, file_);
+		return true;
+	}
+	auto close() -> void {
+		if (file_) {
+			flush();
+			std::fclose(file_);
+			file_ = nullptr;
+		}
+	}
+	auto is_open() const -> bool {
+		return file_ != nullptr;
+	}
+	auto add(const event_record& record) -> void {
+		records_.push_back(record);
+	}
+	auto flush() -> void {
+		if (!records_.empty()) {
+			std::fwrite(records_.data(), sizeof(event_record), records_.size(), file_);
+			records_.clear();
+		}
+	}
+	// Whether anything has been added since the last dispatch record.
+	auto has_events() const -> bool {
+		return !records_.empty() && records_.back().kind != record_kind::dispatch;
+	}
+private:
+	std::FILE* file_ = nullptr;
+	std::vector<event_record> records_;
+};
+
+static
+auto read_recording(const char* path, std::vector<event_record>* records) -> bool {
+	const auto file = std::fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	record_header header;
+	const auto valid =
+		std::fread(&header, sizeof(header), 1, file) == 1 &&
+		std::memcmp(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) == 0 &&
+		header.version == RECORD_VERSION &&
+		header.record_size == sizeof(event_record);
+	if (valid) {
+		records->clear();
+		event_record record;
+		while (std::fread(&record, sizeof(record), 1, file) == 1) {
+			records->push_back(record);
+		}
+	}
+	std::fclose(file);
+	return valid;
+}
+
+} // edwin
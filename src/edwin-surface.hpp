@@ -0,0 +1,77 @@
+#pragma once
+
+// The platform independent part of edwin::surface. Pixels are drawn into
+// an RGBA buffer and converted into the platform's format by present(),
+// only for the rects which changed.
+
+#include "edwin.hpp"
+#include "edwin-icon.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace edwin {
+
+struct surface_pixels {
+	edwin::size size;
+	std::vector<rgba> data;
+};
+
+// Returns true if the size changed, i.e. the platform's buffers have to be
+// reallocated too.
+static
+auto resize(surface_pixels* pixels, edwin::size size) -> bool {
+	size.width  = std::max(size.width, 0);
+	size.height = std::max(size.height, 0);
+	if (size.width == pixels->size.width && size.height == pixels->size.height) {
+		return false;
+	}
+	pixels->size = size;
+	pixels->data.assign(size_t(size.width) * size_t(size.height), rgba{});
+	return true;
+}
+
+static
+auto clip(rect r, edwin::size size) -> rect {
+	const auto x0 = std::clamp(r.x, 0, size.width);
+	const auto y0 = std::clamp(r.y, 0, size.height);
+	const auto x1 = std::clamp(r.x + r.width, 0, size.width);
+	const auto y1 = std::clamp(r.y + r.height, 0, size.height);
+	return {x0, y0, x1 - x0, y1 - y0};
+}
+
+// Calls fn with each dirty rect clipped to the buffer, or with the whole
+// buffer if dirty is empty. Empty rects are skipped.
+template <typename Fn>
+static
+auto for_each_dirty(const surface_pixels& pixels, std::span<const rect> dirty, Fn fn) -> void {
+	if (dirty.empty()) {
+		if (pixels.size.width > 0 && pixels.size.height > 0) {
+			fn(rect{0, 0, pixels.size.width, pixels.size.height});
+		}
+		return;
+	}
+	for (const auto r : dirty) {
+		const auto clipped = clip(r, pixels.size);
+		if (clipped.width > 0 && clipped.height > 0) {
+			fn(clipped);
+		}
+	}
+}
+
+// Converts rect r of the buffer to 32-bit ARGB, the format of a 24-bit
+// TrueColor X visual and of a 32-bit DIB. dst points at the destination
+// of the rect's top left pixel. dst_stride is in pixels and can be
+// negative for bottom-up images.
+static
+auto convert(const surface_pixels& pixels, rect r, uint32_t* dst, ptrdiff_t dst_stride) -> void {
+	auto src = pixels.data.data() + size_t(r.y) * size_t(pixels.size.width) + size_t(r.x);
+	for (auto y = 0; y < r.height; y++) {
+		rgba_to_argb(src, dst, size_t(r.width));
+		src += pixels.size.width;
+		dst += dst_stride;
+	}
+}
+
+} // edwin
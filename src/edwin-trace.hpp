@@ -0,0 +1,112 @@
+#pragma once
+
+// Instrumentation hooks, shared by all the backends. With no sink
+// installed every hook is a single predictable branch.
+
+#include "edwin.hpp"
+#include <chrono>
+#include <optional>
+#include <utility>
+
+namespace edwin {
+
+static trace_sink trace_sink_;
+static bool tracing_ = false;
+// How many sink functions are running. set_trace_sink() mustn't destroy
+// one of them, so while this is non-zero the new sink waits here.
+static int trace_hook_depth_ = 0;
+static std::optional<trace_sink> pending_trace_sink_;
+// Bumped whenever the sink changes, so that a scope only reports its end
+// to the sink which saw its beg.
+static uint32_t trace_sink_serial_ = 0;
+
+static
+auto apply_trace_sink(trace_sink sink) -> void {
+	tracing_ = sink.beg || sink.end || sink.event;
+	trace_sink_ = std::move(sink);
+	trace_sink_serial_++;
+}
+
+auto set_trace_sink(trace_sink sink) -> void {
+	if (trace_hook_depth_ > 0) {
+		pending_trace_sink_ = std::move(sink);
+		return;
+	}
+	apply_trace_sink(std::move(sink));
+}
+
+template <typename Fn, typename... Args>
+static
+auto call_hook(const Fn& fn, Args... args) -> void {
+	trace_hook_depth_++;
+	fn(args...);
+	if (--trace_hook_depth_ == 0 && pending_trace_sink_) {
+		apply_trace_sink(std::move(*pending_trace_sink_));
+		pending_trace_sink_.reset();
+	}
+}
+
+static
+auto trace_beg(trace_scope scope, const window* wnd) -> std::chrono::steady_clock::time_point {
+	if (trace_sink_.beg) {
+		call_hook(trace_sink_.beg, scope, wnd);
+	}
+	return std::chrono::steady_clock::now();
+}
+
+static
+auto trace_end(trace_scope scope, const window* wnd, std::chrono::steady_clock::time_point beg) -> void {
+	const auto elapsed = std::chrono::steady_clock::now() - beg;
+	if (trace_sink_.end) {
+		call_hook(trace_sink_.end, scope, wnd, elapsed);
+	}
+}
+
+static
+auto trace_event(const window* wnd, int type) -> void {
+	if (trace_sink_.event) {
+		call_hook(trace_sink_.event, wnd, type);
+	}
+}
+
+// Wraps a block of work which isn't a user callback.
+struct traced {
+	traced(trace_scope scope, const window* wnd = nullptr) : scope_{scope}, wnd_{wnd}, active_{tracing_}, serial_{trace_sink_serial_} {
+		if (active_) {
+			beg_ = trace_beg(scope_, wnd_);
+		}
+	}
+	~traced() {
+		// Not tracing_, which a sink installed inside the scope would turn
+		// on. A sink swapped in since the beg, even from inside the beg
+		// hook, would get an end with no beg too.
+		if (active_ && serial_ == trace_sink_serial_) {
+			trace_end(scope_, wnd_, beg_);
+		}
+	}
+	traced(const traced&) = delete;
+	traced& operator=(const traced&) = delete;
+private:
+	trace_scope scope_;
+	const window* wnd_;
+	bool active_;
+	uint32_t serial_;
+	std::chrono::steady_clock::time_point beg_;
+};
+
+// Calls fn(args...) if it's set, inside a trace scope.
+template <typename Fn, typename... Args>
+static
+auto invoke(trace_scope scope, const window* wnd, const Fn& fn, Args&&... args) -> void {
+	if (!fn) {
+		return;
+	}
+	if (!tracing_) {
+		fn(std::forward<Args>(args)...);
+		return;
+	}
+	const auto traced_scope = traced{scope, wnd};
+	fn(std::forward<Args>(args)...);
+}
+
+} // edwin
@@ -1,7 +1,15 @@
 #define NOMINMAX
 #include "dwmapi.h"
 #include "edwin.hpp"
+#include "edwin-frame.hpp"
+#include "edwin-icon.hpp"
+#include "edwin-queue.hpp"
+#include "edwin-surface.hpp"
+#include "edwin-trace.hpp"
+#include <array>
+#include <atomic>
 #include <memory>
+#include <unordered_set>
 #include <Windows.h>
 
 namespace edwin {
@@ -9,36 +17,96 @@ namespace edwin {
 static constexpr auto MIN_SIZE = 10;
 
 struct window {
-	HWND hwnd   = nullptr;
-	HICON hicon = nullptr;
+	HWND hwnd         = nullptr;
+	HICON hicon_big   = nullptr;
+	HICON hicon_small = nullptr;
 	bool user_resizing = false;
 	fn::on_window_closed on_closed;
+	fn::on_window_damaged on_damaged;
 	fn::on_window_resized on_resized;
 	fn::on_window_resizing on_resizing;
+	fn::on_key on_key;
+	fn::on_mouse_button on_mouse_button;
+	fn::on_mouse_move on_mouse_move;
+	fn::on_mouse_wheel on_mouse_wheel;
+	// frame_serial is bumped by set(window*, fn::frame, ...), so a frame
+	// callback which replaced itself isn't put back. While frame_depth is
+	// non-zero WM_DESTROY leaves deleting the window to wm_timer.
+	fn::frame on_frame;
+	uint32_t frame_serial = 0;
+	int frame_depth = 0;
+	bool destroyed = false;
 };
 
+// HICONs for the last few distinct icons, so setting the same icon on
+// another window doesn't convert or allocate anything. Windows doesn't
+// copy the icon passed to WM_SETICON, so entries are reference counted
+// and only destroyed once no window is using them.
+struct cached_hicon {
+	uint64_t hash = 0;
+	uint64_t used = 0;
+	HICON hicon   = nullptr;
+	int refs      = 0;
+	icon_source source;
+};
+
+static std::array<cached_hicon, 8> hicon_cache_;
+// Windows which haven't been deleted yet.
+static std::unordered_set<window*> live_windows_;
+static uint64_t hicon_tick_ = 0;
+static mpsc_queue<edwin::function<void()>> posted_;
+static std::atomic<DWORD> ui_thread_ = 0;
 static UINT_PTR app_timer_ = 0;
+// The id of each window's timer for set(window*, fn::frame, ...).
+static constexpr UINT_PTR FRAME_TIMER_ID = 1;
 static fn::frame app_frame_;
+static frame_ticker app_frames_;
 static bool app_schedule_stop_ = false;
 
 static
-auto app_timer_proc(HWND hwnd, UINT msg, UINT_PTR id, DWORD time) -> void {
-	if (app_frame_.fn) {
-		app_frame_.fn();
+auto run_posted() -> void {
+	ui_thread_ = GetCurrentThreadId();
+	const auto scope = traced{trace_scope::posted};
+	edwin::function<void()> fn;
+	while (posted_.pop(&fn)) {
+		fn();
 	}
 }
 
+static
+auto app_timer_proc(HWND hwnd, UINT msg, UINT_PTR id, DWORD time) -> void {
+	// Also runs during the modal loop while a window is being resized,
+	// when our own message loop doesn't get a look in.
+	run_posted();
+	app_frames_.on_tick(app_frame_);
+}
+
 static
 auto get_window(HWND hwnd) -> window* {
 	return (window*)(GetWindowLongPtr(hwnd, GWLP_USERDATA));
 }
 
+// Used by post(window*, ...), see edwin-post.hpp.
+static
+auto make_ref(const window* wnd) -> HWND {
+	return wnd->hwnd;
+}
+
+static
+auto resolve(HWND hwnd) -> window* {
+	return IsWindow(hwnd) ? get_window(hwnd) : nullptr;
+}
+
+// Used by the awaiters, see edwin-await.hpp.
+static
+auto is_alive(window* wnd) -> bool {
+	return live_windows_.contains(wnd);
+}
+
 static
 auto wm_close(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
 	if (const auto wnd = get_window(hwnd)) {
-		if (wnd->on_closed.fn) {
-			wnd->on_closed.fn();
-		}
+		invoke(trace_scope::on_closed, wnd, wnd->on_closed.fn);
 		destroy(wnd);
 	}
 	return 0;
@@ -51,22 +119,156 @@ auto wm_create(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
 	return 0;
 }
 
+static
+auto release_hicon(HICON hicon) -> void;
+
 static
 auto wm_destroy(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
 	if (const auto wnd = get_window(hwnd)) {
+		release_hicon(wnd->hicon_big);
+		release_hicon(wnd->hicon_small);
+		if (wnd->frame_depth > 0) {
+			wnd->destroyed = true;
+			return 0;
+		}
+		live_windows_.erase(wnd);
 		delete wnd;
+		resume_window_waiters(wnd);
+	}
+	return 0;
+}
+
+static
+auto get_modifiers() -> key_modifiers {
+	return {
+		.shift = GetKeyState(VK_SHIFT) < 0,
+		.ctrl  = GetKeyState(VK_CONTROL) < 0,
+		.alt   = GetKeyState(VK_MENU) < 0,
+		.super = GetKeyState(VK_LWIN) < 0 || GetKeyState(VK_RWIN) < 0,
+	};
+}
+
+static
+auto make_input_time() -> input_time {
+	return {static_cast<uint32_t>(GetMessageTime()), std::chrono::steady_clock::now()};
+}
+
+static
+auto get_position(LPARAM l) -> position {
+	// Coordinates are signed, e.g. while the mouse is captured.
+	return {static_cast<short>(LOWORD(l)), static_cast<short>(HIWORD(l))};
+}
+
+static
+auto wm_key(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	const auto wnd = get_window(hwnd);
+	if (!wnd || !wnd->on_key.fn) {
+		// Without a callback it gets the default handling.
+		return DefWindowProc(hwnd, msg, w, l);
+	}
+	const auto pressed = msg == WM_KEYDOWN || msg == WM_SYSKEYDOWN;
+	const auto scancode = static_cast<uint32_t>((l >> 16) & 0x1ff);
+	invoke(trace_scope::on_key, wnd, wnd->on_key.fn, key_event{scancode, static_cast<uint32_t>(w), pressed, get_modifiers(), make_input_time()});
+	if (msg == WM_SYSKEYDOWN || msg == WM_SYSKEYUP) {
+		// For Alt+F4 etc.
+		return DefWindowProc(hwnd, msg, w, l);
+	}
+	return 0;
+}
+
+static
+auto wm_mouse_button(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	auto button = mouse_button::left;
+	auto pressed = false;
+	switch (msg) {
+		case WM_LBUTTONDOWN: { button = mouse_button::left; pressed = true; break; }
+		case WM_LBUTTONUP:   { button = mouse_button::left; break; }
+		case WM_MBUTTONDOWN: { button = mouse_button::middle; pressed = true; break; }
+		case WM_MBUTTONUP:   { button = mouse_button::middle; break; }
+		case WM_RBUTTONDOWN: { button = mouse_button::right; pressed = true; break; }
+		case WM_RBUTTONUP:   { button = mouse_button::right; break; }
+		case WM_XBUTTONDOWN:
+		case WM_XBUTTONUP: {
+			button  = GET_XBUTTON_WPARAM(w) == XBUTTON1 ? mouse_button::back : mouse_button::forward;
+			pressed = msg == WM_XBUTTONDOWN;
+			break;
+		}
+	}
+	// Keep getting mouse input while a button is held, even outside the window.
+	const auto any_held = (w & (MK_LBUTTON | MK_MBUTTON | MK_RBUTTON | MK_XBUTTON1 | MK_XBUTTON2)) != 0;
+	if (pressed)        { SetCapture(hwnd); }
+	else if (!any_held) { ReleaseCapture(); }
+	if (const auto wnd = get_window(hwnd)) {
+		invoke(trace_scope::on_mouse_button, wnd, wnd->on_mouse_button.fn, mouse_button_event{button, pressed, get_position(l), get_modifiers(), make_input_time()});
+	}
+	return (msg == WM_XBUTTONDOWN || msg == WM_XBUTTONUP) ? TRUE : 0;
+}
+
+static
+auto wm_mouse_move(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	if (const auto wnd = get_window(hwnd)) {
+		invoke(trace_scope::on_mouse_move, wnd, wnd->on_mouse_move.fn, mouse_move_event{get_position(l), get_modifiers(), make_input_time()});
 	}
 	return 0;
 }
 
+static
+auto wm_mouse_wheel(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	const auto wnd = get_window(hwnd);
+	if (!wnd || !wnd->on_mouse_wheel.fn) {
+		// DefWindowProc() passes it up to the parent, e.g. so that a host
+		// can scroll the view an embedded editor is in.
+		return DefWindowProc(hwnd, msg, w, l);
+	}
+	// Wheel messages have screen coordinates.
+	const auto screen = get_position(l);
+	auto point = POINT{screen.x, screen.y};
+	ScreenToClient(hwnd, &point);
+	const auto notches = static_cast<float>(GET_WHEEL_DELTA_WPARAM(w)) / WHEEL_DELTA;
+	const auto dx = msg == WM_MOUSEHWHEEL ? notches : 0.0f;
+	const auto dy = msg == WM_MOUSEWHEEL ? notches : 0.0f;
+	invoke(trace_scope::on_mouse_wheel, wnd, wnd->on_mouse_wheel.fn, mouse_wheel_event{dx, dy, {point.x, point.y}, get_modifiers(), make_input_time()});
+	return 0;
+}
+
+static
+auto wm_paint(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	const auto wnd = get_window(hwnd);
+	if (!wnd || !wnd->on_damaged.fn) {
+		return DefWindowProc(hwnd, msg, w, l);
+	}
+	static std::vector<rect> rects;
+	static std::vector<std::byte> region_data;
+	rects.clear();
+	// The update region has to be read before BeginPaint() validates it.
+	const auto region = CreateRectRgn(0, 0, 0, 0);
+	if (GetUpdateRgn(hwnd, region, FALSE) > NULLREGION) {
+		region_data.resize(GetRegionData(region, 0, nullptr));
+		const auto data = reinterpret_cast<RGNDATA*>(region_data.data());
+		if (GetRegionData(region, static_cast<DWORD>(region_data.size()), data)) {
+			const auto r = reinterpret_cast<const RECT*>(data->Buffer);
+			for (DWORD i = 0; i < data->rdh.nCount; i++) {
+				rects.push_back({r[i].left, r[i].top, r[i].right - r[i].left, r[i].bottom - r[i].top});
+			}
+		}
+	}
+	DeleteObject(region);
+	PAINTSTRUCT ps;
+	BeginPaint(hwnd, &ps);
+	EndPaint(hwnd, &ps);
+	invoke(trace_scope::on_damaged, wnd, wnd->on_damaged.fn, std::span<const rect>{rects});
+	return 0;
+}
+
 static
 auto wm_size(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
 	if (const auto wnd = get_window(hwnd)) {
-		if (wnd->on_resized.fn && !wnd->user_resizing) {
+		if (!wnd->user_resizing) {
 			const auto type   = w;
 			const auto width  = LOWORD(l);
 			const auto height = HIWORD(l);
-			wnd->on_resized.fn(size{width, height});
+			invoke(trace_scope::on_resized, wnd, wnd->on_resized.fn, size{width, height});
+			resume_resized(wnd, size{width, height});
 		}
 	}
 	return 0;
@@ -80,7 +282,7 @@ auto wm_sizing(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
 			GetClientRect(hwnd, &rect);
 			const auto width  = rect.right - rect.left;
 			const auto height = rect.bottom - rect.top;
-			wnd->on_resizing.fn(size{width, height});
+			invoke(trace_scope::on_resizing, wnd, wnd->on_resizing.fn, size{width, height});
 		}
 	}
 	return 0;
@@ -98,27 +300,76 @@ static
 auto wm_exit_size_move(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
 	if (const auto wnd = get_window(hwnd)) {
 		wnd->user_resizing = false;
-		if (wnd->on_resized.fn) {
-			RECT rect;
-			GetClientRect(hwnd, &rect);
-			const auto width  = rect.right - rect.left;
-			const auto height = rect.bottom - rect.top;
-			wnd->on_resized.fn(size{width, height});
+		RECT rect;
+		GetClientRect(hwnd, &rect);
+		const auto width  = rect.right - rect.left;
+		const auto height = rect.bottom - rect.top;
+		invoke(trace_scope::on_resized, wnd, wnd->on_resized.fn, size{width, height});
+		resume_resized(wnd, size{width, height});
+	}
+	return 0;
+}
+
+static
+auto wm_timer(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	if (w != FRAME_TIMER_ID) {
+		return DefWindowProc(hwnd, msg, w, l);
+	}
+	const auto wnd = get_window(hwnd);
+	if (!wnd) {
+		return 0;
+	}
+	// Moved out for the call in case the callback replaces itself or
+	// destroys the window.
+	auto frame = std::move(wnd->on_frame);
+	const auto serial = wnd->frame_serial;
+	wnd->frame_depth++;
+	invoke(trace_scope::frame, wnd, frame.fn);
+	wnd->frame_depth--;
+	if (wnd->destroyed) {
+		if (wnd->frame_depth == 0) {
+			live_windows_.erase(wnd);
+			delete wnd;
+			resume_window_waiters(wnd);
 		}
+		return 0;
+	}
+	if (wnd->frame_serial == serial) {
+		wnd->on_frame = std::move(frame);
 	}
 	return 0;
 }
 
 static
 auto CALLBACK wndproc(HWND hwnd, UINT msg, WPARAM w, LPARAM l) -> LRESULT {
+	if (tracing_) {
+		trace_event(get_window(hwnd), static_cast<int>(msg));
+	}
 	switch (msg) {
 		case WM_CLOSE:         { return wm_close(hwnd, msg, w, l); }
 		case WM_CREATE:        { return wm_create(hwnd, msg, w, l); }
 		case WM_DESTROY:       { return wm_destroy(hwnd, msg, w, l); }
 		case WM_ENTERSIZEMOVE: { return wm_enter_size_move(hwnd, msg, w, l); }
 		case WM_EXITSIZEMOVE:  { return wm_exit_size_move(hwnd, msg, w, l); }
+		case WM_KEYDOWN:
+		case WM_KEYUP:
+		case WM_SYSKEYDOWN:
+		case WM_SYSKEYUP:      { return wm_key(hwnd, msg, w, l); }
+		case WM_LBUTTONDOWN:
+		case WM_LBUTTONUP:
+		case WM_MBUTTONDOWN:
+		case WM_MBUTTONUP:
+		case WM_RBUTTONDOWN:
+		case WM_RBUTTONUP:
+		case WM_XBUTTONDOWN:
+		case WM_XBUTTONUP:     { return wm_mouse_button(hwnd, msg, w, l); }
+		case WM_MOUSEMOVE:     { return wm_mouse_move(hwnd, msg, w, l); }
+		case WM_MOUSEWHEEL:
+		case WM_MOUSEHWHEEL:   { return wm_mouse_wheel(hwnd, msg, w, l); }
+		case WM_PAINT:         { return wm_paint(hwnd, msg, w, l); }
 		case WM_SIZE:          { return wm_size(hwnd, msg, w, l); }
 		case WM_SIZING:        { return wm_sizing(hwnd, msg, w, l); }
+		case WM_TIMER:         { return wm_timer(hwnd, msg, w, l); }
 	}
 	return DefWindowProc(hwnd, msg, w, l);
 }
@@ -174,27 +425,15 @@ auto make_hicon_color(edwin::icon icon) -> HBITMAP {
 		ReleaseDC(nullptr, hdc);
 		return nullptr;
 	}
-	for (auto y = 0; y < icon.size.height; y++) {
-		for (auto x = 0; x < icon.size.width; x++) {
-			const auto i = y * icon.size.width + x;
-			const auto r = icon.pixels[i].r;
-			const auto g = icon.pixels[i].g;
-			const auto b = icon.pixels[i].b;
-			const auto a = icon.pixels[i].a;
-			const auto index = (y * icon.size.width + x) * 4;
-			reinterpret_cast<BYTE*>(dib_pixels)[index + 0] = static_cast<BYTE>(b);
-			reinterpret_cast<BYTE*>(dib_pixels)[index + 1] = static_cast<BYTE>(g);
-			reinterpret_cast<BYTE*>(dib_pixels)[index + 2] = static_cast<BYTE>(r);
-			reinterpret_cast<BYTE*>(dib_pixels)[index + 3] = static_cast<BYTE>(a);
-		}
-	}
+	// Rows of a 32-bit DIB are always tightly packed.
+	rgba_to_argb(icon.pixels.data(), reinterpret_cast<uint32_t*>(dib_pixels), pixel_count(icon));
 	ReleaseDC(nullptr, hdc);
 	return bitmap;
 }
 
 static
 auto make_hicon(edwin::icon icon) -> HICON {
-	if (icon.size.width <= 0 || icon.size.height <= 0) {
+	if (!is_valid(icon)) {
 		return nullptr;
 	}
 	ICONINFO iconinfo;
@@ -212,7 +451,103 @@ auto make_hicon(edwin::icon icon) -> HICON {
 	return hicon;
 }
 
-auto create(window_config cfg) -> window* {
+static
+auto acquire_hicon(const edwin::icon& icon) -> HICON {
+	if (!is_valid(icon)) {
+		return nullptr;
+	}
+	const auto hash = hash_icons({&icon, 1});
+	hicon_tick_++;
+	for (auto& e : hicon_cache_) {
+		if (e.hicon && e.hash == hash && e.source.matches({&icon, 1})) {
+			e.refs++;
+			e.used = hicon_tick_;
+			return e.hicon;
+		}
+	}
+	const auto hicon = make_hicon(icon);
+	if (!hicon) {
+		return nullptr;
+	}
+	cached_hicon* victim = nullptr;
+	for (auto& e : hicon_cache_) {
+		if (e.refs > 0) {
+			continue;
+		}
+		if (!victim || e.used < victim->used) {
+			victim = &e;
+		}
+	}
+	if (victim) {
+		if (victim->hicon) {
+			DestroyIcon(victim->hicon);
+		}
+		victim->hash  = hash;
+		victim->used  = hicon_tick_;
+		victim->hicon = hicon;
+		victim->refs  = 1;
+		victim->source.assign({&icon, 1});
+	}
+	// Otherwise every cached icon is in use, so this one just isn't
+	// cached and release_hicon() will destroy it.
+	return hicon;
+}
+
+static
+auto release_hicon(HICON hicon) -> void {
+	if (!hicon) {
+		return;
+	}
+	for (auto& e : hicon_cache_) {
+		if (e.hicon == hicon) {
+			e.refs--;
+			return;
+		}
+	}
+	DestroyIcon(hicon);
+}
+
+// The smallest icon which is at least as big as the system wants, or
+// failing that the biggest one.
+static
+auto pick_icon(std::span<const edwin::icon> icons, int size) -> const edwin::icon* {
+	const edwin::icon* best = nullptr;
+	for (const auto& icon : icons) {
+		if (!is_valid(icon)) {
+			continue;
+		}
+		if (!best) {
+			best = &icon;
+			continue;
+		}
+		const auto big_enough      = icon.size.width >= size;
+		const auto best_big_enough = best->size.width >= size;
+		if (big_enough && (!best_big_enough || icon.size.width < best->size.width)) {
+			best = &icon;
+		}
+		else if (!big_enough && !best_big_enough && icon.size.width > best->size.width) {
+			best = &icon;
+		}
+	}
+	return best;
+}
+
+static
+auto set_icons(window* wnd, std::span<const edwin::icon> icons) -> void {
+	const auto old_big   = wnd->hicon_big;
+	const auto old_small = wnd->hicon_small;
+	const auto big_icon   = pick_icon(icons, GetSystemMetrics(SM_CXICON));
+	const auto small_icon = pick_icon(icons, GetSystemMetrics(SM_CXSMICON));
+	wnd->hicon_big   = big_icon ? acquire_hicon(*big_icon) : nullptr;
+	wnd->hicon_small = small_icon ? acquire_hicon(*small_icon) : nullptr;
+	SendMessage(wnd->hwnd, WM_SETICON, ICON_BIG, (LPARAM)(wnd->hicon_big));
+	SendMessage(wnd->hwnd, WM_SETICON, ICON_SMALL, (LPARAM)(wnd->hicon_small));
+	release_hicon(old_big);
+	release_hicon(old_small);
+}
+
+static
+auto create_window(window_config cfg) -> window* {
 	auto wnd = std::make_unique<window>();
 	const auto exstyle = DWORD{0};
 	const auto wndclass = get_wndclass();
@@ -230,14 +565,36 @@ auto create(window_config cfg) -> window* {
 	if (!wnd->hwnd) {
 		return nullptr;
 	}
-	set(wnd.get(), cfg.on_closed);
-	set(wnd.get(), cfg.on_resized);
-	set(wnd.get(), cfg.on_resizing);
-	set(wnd.get(), cfg.icon);
+	set(wnd.get(), std::move(cfg.on_closed));
+	set(wnd.get(), std::move(cfg.on_damaged));
+	set(wnd.get(), std::move(cfg.on_resized));
+	set(wnd.get(), std::move(cfg.on_resizing));
+	set(wnd.get(), std::move(cfg.on_key));
+	set(wnd.get(), std::move(cfg.on_mouse_button));
+	set(wnd.get(), std::move(cfg.on_mouse_move));
+	set(wnd.get(), std::move(cfg.on_mouse_wheel));
+	if (cfg.icons.value.empty()) { set(wnd.get(), cfg.icon); }
+	else                         { set(wnd.get(), cfg.icons); }
 	set(wnd.get(), cfg.visible);
+	live_windows_.insert(wnd.get());
 	return wnd.release();
 }
 
+auto create(window_config cfg) -> window* {
+	const auto scope = traced{trace_scope::create};
+	return create_window(std::move(cfg));
+}
+
+// Nothing to gain from creating them together here.
+auto create_many(std::span<window_config> cfgs) -> std::vector<window*> {
+	const auto scope = traced{trace_scope::create};
+	auto windows = std::vector<window*>(cfgs.size());
+	for (size_t i = 0; i < cfgs.size(); i++) {
+		windows[i] = create_window(std::move(cfgs[i]));
+	}
+	return windows;
+}
+
 auto destroy(window* wnd) -> void {
 	if (!wnd)       { return; }
 	if (!wnd->hwnd) { return; }
@@ -253,13 +610,11 @@ auto get_hwnd(const window& wnd) -> HWND {
 }
 
 auto set(window* wnd, edwin::icon icon) -> void {
-	auto old_icon = wnd->hicon;
-	wnd->hicon = make_hicon(icon);
-	SendMessage(wnd->hwnd, WM_SETICON, ICON_BIG, (LPARAM)(wnd->hicon));
-	SendMessage(wnd->hwnd, WM_SETICON, ICON_SMALL, (LPARAM)(wnd->hicon));
-	if (old_icon) {
-		DestroyIcon(old_icon);
-	}
+	set_icons(wnd, {&icon, 1});
+}
+
+auto set(window* wnd, edwin::icons icons) -> void {
+	set_icons(wnd, icons.value);
 }
 
 auto set(window* wnd, edwin::position position) -> void {
@@ -278,6 +633,14 @@ auto set(window* wnd, edwin::resizable resizable) -> void {
 	SetWindowPos(wnd->hwnd, 0, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_FRAMECHANGED);
 }
 
+auto set(window* wnd, edwin::resize_settle settle) -> void {
+	// No-op on Windows. The platform tells us when the user has finished resizing.
+}
+
+auto set(window* wnd, edwin::resize_sync sync) -> void {
+	// No-op on Windows. Resizing is already synchronized with the application.
+}
+
 auto set(window* wnd, edwin::size size) -> void {
 	RECT rect = {0, 0, size.width, size.height};
 	const auto style    = GetWindowLong(wnd->hwnd, GWL_STYLE);
@@ -298,18 +661,126 @@ auto set(window* wnd, edwin::visible visible) -> void {
 }
 
 auto set(window* wnd, fn::on_window_closed cb) -> void {
-	wnd->on_closed = cb;
+	wnd->on_closed = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_window_damaged cb) -> void {
+	wnd->on_damaged = std::move(cb);
 }
 
 auto set(window* wnd, fn::on_window_resized cb) -> void {
-	wnd->on_resized = cb;
+	wnd->on_resized = std::move(cb);
 }
 
 auto set(window* wnd, fn::on_window_resizing cb) -> void {
-	wnd->on_resizing = cb;
+	wnd->on_resizing = std::move(cb);
+}
+
+auto set(window* wnd, edwin::compress_motion compress) -> void {
+	// Windows already coalesces WM_MOUSEMOVE.
+}
+
+auto set(window* wnd, fn::on_key cb) -> void {
+	wnd->on_key = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_mouse_button cb) -> void {
+	wnd->on_mouse_button = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_mouse_move cb) -> void {
+	wnd->on_mouse_move = std::move(cb);
+}
+
+auto set(window* wnd, fn::on_mouse_wheel cb) -> void {
+	wnd->on_mouse_wheel = std::move(cb);
+}
+
+auto batch::commit() -> void {
+	if (wnd_) {
+		if (resizable_) { set(wnd_, *resizable_); }
+		if (position_ && size_) {
+			// One SetWindowPos instead of two.
+			RECT rect = {0, 0, size_->width, size_->height};
+			const auto style    = GetWindowLong(wnd_->hwnd, GWL_STYLE);
+			const auto exstyle  = GetWindowLong(wnd_->hwnd, GWL_EXSTYLE);
+			const auto has_menu = GetMenu(wnd_->hwnd) != nullptr;
+			AdjustWindowRectEx(&rect, style, has_menu, exstyle);
+			SetWindowPos(wnd_->hwnd, nullptr, position_->x, position_->y, rect.right - rect.left, rect.bottom - rect.top, SWP_NOZORDER);
+		}
+		else if (position_) { set(wnd_, *position_); }
+		else if (size_)     { set(wnd_, *size_); }
+		if (title_)   { set(wnd_, *title_); }
+		if (icon_)    { set(wnd_, *icon_); }
+		if (icons_)   { set(wnd_, *icons_); }
+		if (visible_) { set(wnd_, *visible_); }
+	}
+	*this = batch{wnd_};
+}
+
+auto post(edwin::function<void()> fn) -> void {
+	posted_.push(std::move(fn));
+	if (const auto thread = ui_thread_.load()) {
+		// Wakes up GetMessage() in app_beg().
+		PostThreadMessage(thread, WM_NULL, 0, 0);
+	}
+}
+
+struct surface {
+	HWND hwnd = nullptr;
+	surface_pixels pixels;
+	// A bottom-up DIB, so source rects are addressed from the bottom left
+	// exactly as documented for SetDIBitsToDevice.
+	std::vector<uint32_t> dib;
+};
+
+auto create_surface(window* wnd) -> surface* {
+	if (!wnd || !wnd->hwnd) { return nullptr; }
+	const auto surf = new surface;
+	surf->hwnd = wnd->hwnd;
+	return surf;
+}
+
+auto destroy(surface* surf) -> void {
+	delete surf;
+}
+
+auto acquire(surface* surf) -> std::span<rgba> {
+	if (!IsWindow(surf->hwnd)) { return {}; }
+	RECT client = {};
+	GetClientRect(surf->hwnd, &client);
+	if (resize(&surf->pixels, {client.right - client.left, client.bottom - client.top})) {
+		surf->dib.assign(surf->pixels.data.size(), 0);
+	}
+	return surf->pixels.data;
+}
+
+auto get_size(const surface& surf) -> edwin::size {
+	return surf.pixels.size;
+}
+
+auto present(surface* surf, std::span<const rect> dirty) -> void {
+	if (!IsWindow(surf->hwnd)) { return; }
+	const auto size = surf->pixels.size;
+	BITMAPINFO info = {};
+	info.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
+	info.bmiHeader.biWidth       = size.width;
+	info.bmiHeader.biHeight      = size.height;
+	info.bmiHeader.biPlanes      = 1;
+	info.bmiHeader.biBitCount    = 32;
+	info.bmiHeader.biCompression = BI_RGB;
+	const auto dc = GetDC(surf->hwnd);
+	for_each_dirty(surf->pixels, dirty, [&](rect r) {
+		const auto bottom_row = ptrdiff_t(size.height - 1 - r.y);
+		convert(surf->pixels, r, surf->dib.data() + bottom_row * size.width + r.x, -ptrdiff_t(size.width));
+		SetDIBitsToDevice(dc, r.x, r.y, r.width, r.height, r.x, size.height - r.y - r.height, 0, size.height, surf->dib.data(), &info, DIB_RGB_COLORS);
+	});
+	ReleaseDC(surf->hwnd, dc);
 }
 
 auto process_messages() -> void {
+	const auto scope = traced{trace_scope::dispatch};
+	run_posted();
 	auto msg = MSG{};
 	while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
 		TranslateMessage(&msg);
@@ -317,14 +788,49 @@ auto process_messages() -> void {
 	}
 }
 
-auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval) -> void {
+auto resize_done(window* wnd) -> void {
+	// No-op on Windows. There is no _NET_WM_SYNC_REQUEST to answer.
+}
+
+// For frame_interval::match_display. The refresh rate of the main display,
+// or the given interval if Windows doesn't know it.
+static
+auto get_frame_period(edwin::frame_interval interval) -> std::chrono::nanoseconds {
+	auto mode = DEVMODE{};
+	mode.dmSize = sizeof(mode);
+	// 0 and 1 mean the hardware's default rate.
+	if (!interval.match_display || !EnumDisplaySettings(nullptr, ENUM_CURRENT_SETTINGS, &mode) || mode.dmDisplayFrequency <= 1) {
+		return interval.value;
+	}
+	return std::chrono::nanoseconds{1'000'000'000 / int64_t{mode.dmDisplayFrequency}};
+}
+
+// Setting the timer again replaces it, and it goes with the window.
+auto set(window* wnd, fn::frame cb, edwin::frame_interval interval) -> void {
+	wnd->on_frame = std::move(cb);
+	wnd->frame_serial++;
+	if (!wnd->on_frame.fn) {
+		KillTimer(wnd->hwnd, FRAME_TIMER_ID);
+		return;
+	}
+	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(get_frame_period(interval));
+	SetTimer(wnd->hwnd, FRAME_TIMER_ID, static_cast<UINT>(ms.count()), nullptr);
+}
+
+auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	const auto period = get_frame_period(interval);
 	app_schedule_stop_ = false;
-	app_frame_ = frame;
-	app_timer_ = SetTimer(nullptr, 1, interval.value.count(), app_timer_proc);
+	app_frame_ = std::move(frame);
+	app_frames_ = frame_ticker{period, overrun};
+	reset_frame_stats();
+	app_timer_ = SetTimer(nullptr, 1, static_cast<UINT>(std::chrono::duration_cast<std::chrono::milliseconds>(period).count()), app_timer_proc);
+	run_posted();
 	auto msg = MSG{};
 	while (GetMessage(&msg, 0, 0, 0)) {
+		const auto scope = traced{trace_scope::dispatch};
 		TranslateMessage(&msg);
 		DispatchMessage(&msg);
+		run_posted();
 		if (app_schedule_stop_) {
 			return;
 		}
@@ -340,3 +846,6 @@ auto app_end() -> void {
 }
 
 } // edwin
+
+// Needs make_ref() and resolve() from above.
+#include "edwin-post.hpp"
@@ -0,0 +1,1211 @@
+#pragma once
+
+// Internals shared by the Xlib (edwin-lin.cpp) and XCB (edwin-xcb.cpp)
+// backends. Only one of them is compiled into the library, so everything
+// in here is static to that translation unit.
+
+#include "edwin.hpp"
+#include "edwin-ext.hpp"
+#include "edwin-frame.hpp"
+#include "edwin-queue.hpp"
+#include "edwin-record.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <X11/X.h>
+
+namespace edwin {
+
+static constexpr auto MIN_SIZE = 10;
+static constexpr auto MAX_SIZE = 10000;
+// Past this many damage rects a window's damage is merged into one.
+static constexpr auto MAX_DAMAGE_RECTS = 16;
+// How many X errors are remembered for check_x_errors().
+static constexpr auto MAX_X_ERRORS = 64;
+// Window frames which fall due this close together are run in the same
+// pass, instead of waking up again for each of them.
+static constexpr auto WINDOW_FRAME_SLACK = std::chrono::milliseconds{1};
+
+// Every atom edwin uses. They are all interned together when the
+// connection is opened. Keep atom_names in the same order.
+enum class atom {
+	net_wm_icon,
+	net_wm_name,
+	net_wm_pid,
+	net_wm_sync_request,
+	net_wm_sync_request_counter,
+	utf8_string,
+	wm_delete_window,
+	wm_protocols,
+	count
+};
+
+static constexpr const char* atom_names[] = {
+	"_NET_WM_ICON",
+	"_NET_WM_NAME",
+	"_NET_WM_PID",
+	"_NET_WM_SYNC_REQUEST",
+	"_NET_WM_SYNC_REQUEST_COUNTER",
+	"UTF8_STRING",
+	"WM_DELETE_WINDOW",
+	"WM_PROTOCOLS",
+};
+
+static_assert(std::size(atom_names) == size_t(atom::count));
+
+// Everything which is released when a window is destroyed.
+struct window_state {
+	Window xwindow = 0;
+	edwin::resizable resizable;
+	edwin::resize_settle resize_settle;
+	edwin::resize_sync resize_sync;
+	edwin::size size;
+	edwin::size pending_size;
+	bool resize_pending = false;
+	bool resize_settling = false;
+	std::chrono::steady_clock::time_point last_resize;
+	// Where the window is on the root window, which decides the monitor
+	// for frame_interval::match_display. Only tracked for top-level
+	// windows. Once the window manager has reparented the window, only
+	// its synthetic ConfigureNotify events are in root coordinates.
+	position root_position;
+	bool top_level = false;
+	bool reparented = false;
+	// Creation order, which identifies the window in recordings.
+	uint32_t ordinal = 0;
+	// _NET_WM_SYNC_REQUEST_COUNTER, and the value the window manager is
+	// waiting for it to be set to.
+	uint32_t sync_counter = 0;
+	int64_t sync_value = 0;
+	bool sync_pending = false;
+	std::vector<rect> damage;
+	bool damage_pending = false;
+	// False while more Expose events of the same burst are still to come.
+	bool damage_complete = false;
+	edwin::compress_motion compress_motion;
+	mouse_move_event pending_motion;
+	bool motion_pending = false;
+	fn::on_window_closed on_closed;
+	fn::on_window_damaged on_damaged;
+	fn::on_window_resized on_resized;
+	fn::on_window_resizing on_resizing;
+	fn::on_key on_key;
+	fn::on_mouse_button on_mouse_button;
+	fn::on_mouse_move on_mouse_move;
+	fn::on_mouse_wheel on_mouse_wheel;
+	// Per-window frames. frame_serial is bumped whenever they change, which
+	// invalidates whatever was scheduled before.
+	fn::frame on_frame;
+	edwin::frame_interval frame_interval;
+	uint32_t frame_serial = 0;
+	// The refresh period of the monitor the window is on, worked out again
+	// when refresh_epoch falls behind display_epoch_.
+	std::chrono::nanoseconds refresh_period{};
+	uint32_t refresh_epoch = 0;
+};
+
+struct window : window_state {
+	uint32_t slot = 0;
+	// Bumped when the window is destroyed, before the slot is reused.
+	uint32_t generation = 0;
+};
+
+// Generation-checked reference to a window slot.
+struct handle {
+	uint32_t slot       = 0;
+	uint32_t generation = 0;
+};
+
+// The window* handed to the application is a ref: the slot and its
+// generation packed into the pointer, not the slot's address. It's never
+// dereferenced. Every function which takes one starts with get_window(ref),
+// so slots can be reused while a window* kept after destroy() still fails
+// to resolve. The low three bits stay clear, like a real pointer's. With
+// 32-bit pointers only the low 12 bits of the generation fit, so a stale
+// ref could resolve again after a slot has been reused 4096 times.
+static constexpr auto REF_SLOT_BITS  = sizeof(uintptr_t) == 8 ? 29 : 17;
+static constexpr auto REF_GEN_SHIFT  = 3 + REF_SLOT_BITS;
+static constexpr auto REF_GEN_MASK   = uint32_t(~uintptr_t{0} >> REF_GEN_SHIFT);
+static constexpr auto REF_SLOT_LIMIT = (uint32_t{1} << REF_SLOT_BITS) - 1;
+
+static std::deque<window> window_slots_;
+// Slots of destroyed windows, ready to be reused.
+static std::vector<uint32_t> free_slots_;
+// Slots of windows destroyed during a dispatch pass, which are released
+// once it's over.
+static std::vector<uint32_t> dead_slots_;
+// Every window which hasn't been destroyed, by X window.
+static std::unordered_map<Window, handle> window_map_;
+static std::vector<handle> resize_pending_;
+static std::vector<handle> resize_settling_;
+static std::vector<handle> damage_pending_;
+static std::vector<handle> motion_pending_;
+static std::vector<handle> sync_pending_;
+// Ring buffer, in serial order.
+static x_error x_errors_[MAX_X_ERRORS];
+static uint64_t x_error_count_ = 0;
+static uint32_t next_ordinal_ = 0;
+static event_recorder recorder_;
+static std::chrono::steady_clock::time_point record_start_;
+static uint32_t record_base_ = 0;
+// Replayed events aren't recorded again, even if a recording is open.
+static bool replaying_ = false;
+static bool dispatching_ = false;
+static mpsc_queue<edwin::function<void()>> posted_;
+static std::atomic<bool> wake_pending_ = false;
+static bool app_schedule_stop_ = false;
+// Frames run by app_beg() or app_attach().
+static bool app_active_ = false;
+static edwin::fn::frame app_frame_;
+static edwin::frame_interval app_interval_;
+static frame_clock app_frames_;
+
+// A window's next frame. Entries which have been invalidated are left in
+// the heap and skipped once they come up.
+struct window_frame {
+	std::chrono::steady_clock::time_point due;
+	handle wnd;
+	uint32_t serial;
+};
+
+// Min-heap of window frames, soonest first.
+static std::vector<window_frame> window_frames_;
+
+// A monitor, as far as frame_interval::match_display is concerned.
+struct crtc {
+	rect area;
+	std::chrono::nanoseconds refresh_period;
+};
+
+static std::vector<crtc> crtcs_;
+static bool randr_checked_ = false;
+static bool randr_available_ = false;
+static bool crtcs_dirty_ = true;
+// Set when a window moves or the monitors change, in case the frame
+// interval should change with them.
+static bool display_dirty_ = true;
+static std::chrono::nanoseconds display_refresh_period_;
+// Moves on when the monitors change, so that every window works out its
+// refresh period again.
+static uint32_t display_epoch_ = 1;
+
+static
+auto operator==(edwin::size a, edwin::size b) -> bool {
+	return a.width == b.width && a.height == b.height;
+}
+
+static
+auto operator==(edwin::position a, edwin::position b) -> bool {
+	return a.x == b.x && a.y == b.y;
+}
+
+static
+auto get_handle(const window& wnd) -> handle {
+	return {wnd.slot, wnd.generation};
+}
+
+static
+auto get_window(handle h) -> window* {
+	if (h.slot >= window_slots_.size()) {
+		return nullptr;
+	}
+	auto& wnd = window_slots_[h.slot];
+	if (((wnd.generation ^ h.generation) & REF_GEN_MASK) || !wnd.xwindow) {
+		return nullptr;
+	}
+	return &wnd;
+}
+
+static
+auto get_ref(const window* wnd) -> window* {
+	if (!wnd) {
+		return nullptr;
+	}
+	const auto bits = uintptr_t(wnd->generation & REF_GEN_MASK) << REF_GEN_SHIFT | uintptr_t(wnd->slot + 1) << 3;
+	return reinterpret_cast<window*>(bits);
+}
+
+static
+auto get_window(const window* ref) -> window* {
+	const auto bits = reinterpret_cast<uintptr_t>(ref);
+	const auto slot = uint32_t(bits >> 3 & REF_SLOT_LIMIT);
+	if (slot == 0) {
+		return nullptr;
+	}
+	return get_window(handle{slot - 1, uint32_t(bits >> REF_GEN_SHIFT)});
+}
+
+// Used by post(window*, ...), see edwin-post.hpp. A ref already carries
+// the generation, so there's nothing to look up on the posting thread.
+static
+auto make_ref(const window* ref) -> const window* {
+	return ref;
+}
+
+static
+auto resolve(const window* ref) -> window* {
+	return get_window(ref) ? const_cast<window*>(ref) : nullptr;
+}
+
+// Used by the awaiters, see edwin-await.hpp.
+static
+auto is_alive(window* ref) -> bool {
+	return get_window(ref) != nullptr;
+}
+
+static
+auto get_window(Window xwindow) -> window* {
+	const auto pos = window_map_.find(xwindow);
+	if (pos == window_map_.end()) {
+		return nullptr;
+	}
+	return get_window(pos->second);
+}
+
+static
+auto alloc_slot() -> window* {
+	if (!free_slots_.empty()) {
+		const auto slot = free_slots_.back();
+		free_slots_.pop_back();
+		return &window_slots_[slot];
+	}
+	if (window_slots_.size() >= REF_SLOT_LIMIT) {
+		return nullptr;
+	}
+	auto& wnd = window_slots_.emplace_back();
+	wnd.slot = static_cast<uint32_t>(window_slots_.size() - 1);
+	return &wnd;
+}
+
+// Frees whatever the window's state owns, e.g. the callbacks, and makes
+// the slot available again. Its generation has already moved on.
+static
+auto release_slot(uint32_t slot) -> void {
+	static_cast<window_state&>(window_slots_[slot]) = window_state{};
+	free_slots_.push_back(slot);
+}
+
+static
+auto release_dead_slots() -> void {
+	for (const auto slot : dead_slots_) {
+		release_slot(slot);
+	}
+	dead_slots_.clear();
+}
+
+static
+auto add_window(Window xwindow, const window_config& cfg) -> window* {
+	const auto wnd = alloc_slot();
+	if (!wnd) {
+		return nullptr;
+	}
+	wnd->xwindow = xwindow;
+	wnd->size = cfg.size;
+	wnd->top_level = !cfg.parent.value;
+	wnd->root_position = cfg.position;
+	wnd->ordinal = next_ordinal_++;
+	window_map_[xwindow] = get_handle(*wnd);
+	return wnd;
+}
+
+// Called by the backend's destroy() once the X window is gone.
+static
+auto remove_window(window* wnd) -> void {
+	const auto ref = get_ref(wnd);
+	window_map_.erase(wnd->xwindow);
+	wnd->xwindow = 0;
+	wnd->generation++;
+	resume_window_waiters(ref);
+	if (dispatching_) {
+		// One of the window's callbacks may still be on the stack
+		// so don't clear them until the dispatch pass is over.
+		dead_slots_.push_back(wnd->slot);
+		return;
+	}
+	release_slot(wnd->slot);
+}
+
+// Recordings number windows relative to the oldest one which is open
+// when recording or replaying starts.
+static
+auto get_oldest_ordinal() -> uint32_t {
+	auto oldest = next_ordinal_;
+	for (const auto& [xwindow, h] : window_map_) {
+		oldest = std::min(oldest, window_slots_[h.slot].ordinal);
+	}
+	return oldest;
+}
+
+static
+auto pack_modifiers(key_modifiers mods) -> uint8_t {
+	return
+		(mods.shift ? RECORD_SHIFT : 0) |
+		(mods.ctrl  ? RECORD_CTRL  : 0) |
+		(mods.alt   ? RECORD_ALT   : 0) |
+		(mods.super ? RECORD_SUPER : 0);
+}
+
+static
+auto unpack_modifiers(uint8_t flags) -> key_modifiers {
+	return {
+		.shift = (flags & RECORD_SHIFT) != 0,
+		.ctrl  = (flags & RECORD_CTRL) != 0,
+		.alt   = (flags & RECORD_ALT) != 0,
+		.super = (flags & RECORD_SUPER) != 0,
+	};
+}
+
+static
+auto record(const window* wnd, event_record r) -> void {
+	if (!recorder_.is_open() || replaying_) {
+		return;
+	}
+	r.time   = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - record_start_).count());
+	r.window = wnd ? wnd->ordinal - record_base_ : 0;
+	recorder_.add(r);
+}
+
+// synthetic is set for events which came from SendEvent.
+static
+auto on_notify_configure(Window xwindow, position pos, edwin::size size, bool synthetic) -> void {
+	// ConfigureNotify tends to arrive in bursts during an interactive
+	// resize, so just remember the latest size here and report it once
+	// the queue has been drained.
+	if (const auto wnd = get_window(xwindow)) {
+		record(wnd, {.kind = record_kind::configure, .flags = synthetic ? RECORD_SYNTHETIC : uint8_t(0), .a = size.width, .b = size.height, .c = pos.x, .d = pos.y});
+		if (wnd->top_level && (synthetic || !wnd->reparented) && !(pos == wnd->root_position)) {
+			wnd->root_position = pos;
+			wnd->refresh_epoch = 0;
+			display_dirty_     = true;
+		}
+		wnd->pending_size = size;
+		if (!wnd->resize_pending) {
+			wnd->resize_pending = true;
+			resize_pending_.push_back(get_handle(*wnd));
+		}
+	}
+}
+
+static
+auto on_notify_reparent(Window xwindow, bool to_root) -> void {
+	if (const auto wnd = get_window(xwindow)) {
+		wnd->reparented = !to_root;
+	}
+}
+
+// RandR says the monitors changed.
+static
+auto on_notify_screen_change() -> void {
+	crtcs_dirty_   = true;
+	display_dirty_ = true;
+	display_epoch_++;
+}
+
+// The window was closed by the user (WM_DELETE_WINDOW) or destroyed by
+// someone else.
+static
+auto on_notify_destroy(Window xwindow) -> void {
+	if (const auto wnd = get_window(xwindow)) {
+		record(wnd, {.kind = record_kind::destroy});
+		invoke(trace_scope::on_closed, get_ref(wnd), wnd->on_closed.fn);
+		destroy(get_ref(wnd));
+	}
+}
+
+// Implemented by the backend.
+static
+auto write_sync_counter(window* wnd, int64_t value) -> void;
+
+// The window manager is about to resize the window and wants the sync
+// counter set to value once we've caught up.
+static
+auto on_sync_request(Window xwindow, int64_t value) -> void {
+	if (const auto wnd = get_window(xwindow)) {
+		record(wnd, {.kind = record_kind::sync_request, .a = static_cast<int32_t>(value), .b = static_cast<int32_t>(value >> 32)});
+		wnd->sync_value = value;
+		if (!wnd->sync_pending) {
+			wnd->sync_pending = true;
+			sync_pending_.push_back(get_handle(*wnd));
+		}
+	}
+}
+
+static
+auto ack_sync(window* wnd) -> void {
+	if (!wnd->sync_pending || !wnd->sync_counter) {
+		return;
+	}
+	wnd->sync_pending = false;
+	write_sync_counter(wnd, wnd->sync_value);
+}
+
+// Windows with resize_sync are left for resize_done().
+static
+auto flush_syncs() -> void {
+	static std::vector<handle> pending;
+	pending.swap(sync_pending_);
+	for (const auto h : pending) {
+		const auto wnd = get_window(h);
+		if (wnd && !wnd->resize_sync.value) {
+			ack_sync(wnd);
+		}
+	}
+	pending.clear();
+}
+
+static
+auto contains(rect outer, rect inner) -> bool {
+	return inner.x >= outer.x && inner.y >= outer.y &&
+		inner.x + inner.width <= outer.x + outer.width &&
+		inner.y + inner.height <= outer.y + outer.height;
+}
+
+static
+auto bounds(rect a, rect b) -> rect {
+	const auto x0 = std::min(a.x, b.x);
+	const auto y0 = std::min(a.y, b.y);
+	const auto x1 = std::max(a.x + a.width, b.x + b.width);
+	const auto y1 = std::max(a.y + a.height, b.y + b.height);
+	return {x0, y0, x1 - x0, y1 - y0};
+}
+
+static
+auto add_damage(window* wnd, rect r) -> void {
+	for (auto& d : wnd->damage) {
+		if (contains(d, r)) {
+			return;
+		}
+		if (contains(r, d)) {
+			d = r;
+			return;
+		}
+	}
+	if (wnd->damage.size() < MAX_DAMAGE_RECTS) {
+		wnd->damage.push_back(r);
+		return;
+	}
+	for (const auto d : wnd->damage) {
+		r = bounds(r, d);
+	}
+	wnd->damage.assign(1, r);
+}
+
+// count is the number of Expose events which follow this one in the
+// same burst.
+static
+auto on_notify_expose(Window xwindow, rect r, int count) -> void {
+	if (const auto wnd = get_window(xwindow)) {
+		record(wnd, {.kind = record_kind::expose, .a = r.x, .b = r.y, .c = r.width, .d = r.height, .e = static_cast<uint32_t>(count)});
+		add_damage(wnd, r);
+		wnd->damage_complete = count == 0;
+		if (!wnd->damage_pending) {
+			wnd->damage_pending = true;
+			damage_pending_.push_back(get_handle(*wnd));
+		}
+	}
+}
+
+static
+auto flush_damage() -> void {
+	static std::vector<handle> pending;
+	static std::vector<rect> damage;
+	pending.swap(damage_pending_);
+	for (const auto h : pending) {
+		const auto wnd = get_window(h);
+		if (!wnd) {
+			continue;
+		}
+		if (!wnd->damage_complete) {
+			// The rest of the burst hasn't been read yet.
+			damage_pending_.push_back(h);
+			continue;
+		}
+		wnd->damage_pending = false;
+		damage.swap(wnd->damage);
+		invoke(trace_scope::on_damaged, get_ref(wnd), wnd->on_damaged.fn, std::span<const rect>{damage});
+		damage.clear();
+	}
+	pending.clear();
+}
+
+// The event mask for the input events handled below.
+static constexpr long INPUT_EVENT_MASK = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask;
+
+static
+auto get_modifiers(unsigned int state) -> key_modifiers {
+	return {
+		.shift = (state & ShiftMask) != 0,
+		.ctrl  = (state & ControlMask) != 0,
+		.alt   = (state & Mod1Mask) != 0,
+		.super = (state & Mod4Mask) != 0,
+	};
+}
+
+static
+auto make_input_time(unsigned long server_time) -> input_time {
+	return {static_cast<uint32_t>(server_time), std::chrono::steady_clock::now()};
+}
+
+static
+auto flush_motion(window* wnd) -> void {
+	if (!wnd->motion_pending) {
+		return;
+	}
+	wnd->motion_pending = false;
+	invoke(trace_scope::on_mouse_move, get_ref(wnd), wnd->on_mouse_move.fn, wnd->pending_motion);
+}
+
+static
+auto flush_motions() -> void {
+	static std::vector<handle> pending;
+	pending.swap(motion_pending_);
+	for (const auto h : pending) {
+		if (const auto wnd = get_window(h)) {
+			flush_motion(wnd);
+		}
+	}
+	pending.clear();
+}
+
+static
+auto on_input_motion(Window xwindow, const mouse_move_event& event) -> void {
+	const auto wnd = get_window(xwindow);
+	if (!wnd) {
+		return;
+	}
+	record(wnd, {.kind = record_kind::motion, .flags = pack_modifiers(event.modifiers), .a = event.position.x, .b = event.position.y, .e = event.time.server});
+	if (!wnd->compress_motion.value) {
+		invoke(trace_scope::on_mouse_move, get_ref(wnd), wnd->on_mouse_move.fn, event);
+		return;
+	}
+	wnd->pending_motion = event;
+	if (!wnd->motion_pending) {
+		wnd->motion_pending = true;
+		motion_pending_.push_back(get_handle(*wnd));
+	}
+}
+
+static
+auto on_input_button(Window xwindow, unsigned int button, bool pressed, position pos, key_modifiers mods, input_time time) -> void {
+	const auto wnd = get_window(xwindow);
+	if (!wnd) {
+		return;
+	}
+	const auto flags = static_cast<uint8_t>(pack_modifiers(mods) | (pressed ? RECORD_PRESSED : 0));
+	record(wnd, {.kind = record_kind::button, .flags = flags, .a = pos.x, .b = pos.y, .c = static_cast<int32_t>(button), .e = time.server});
+	// A compressed move which came before this has to be reported first.
+	flush_motion(wnd);
+	const auto wheel = [&](float dx, float dy) {
+		// The core protocol reports each notch as a press and release.
+		if (pressed) {
+			invoke(trace_scope::on_mouse_wheel, get_ref(wnd), wnd->on_mouse_wheel.fn, mouse_wheel_event{dx, dy, pos, mods, time});
+		}
+	};
+	const auto click = [&](mouse_button b) {
+		invoke(trace_scope::on_mouse_button, get_ref(wnd), wnd->on_mouse_button.fn, mouse_button_event{b, pressed, pos, mods, time});
+	};
+	switch (button) {
+		case 1: { click(mouse_button::left); break; }
+		case 2: { click(mouse_button::middle); break; }
+		case 3: { click(mouse_button::right); break; }
+		case 4: { wheel(0.0f, 1.0f); break; }
+		case 5: { wheel(0.0f, -1.0f); break; }
+		case 6: { wheel(-1.0f, 0.0f); break; }
+		case 7: { wheel(1.0f, 0.0f); break; }
+		case 8: { click(mouse_button::back); break; }
+		case 9: { click(mouse_button::forward); break; }
+		default: { break; }
+	}
+}
+
+static
+auto on_input_key(Window xwindow, const key_event& event) -> void {
+	if (const auto wnd = get_window(xwindow)) {
+		const auto flags = static_cast<uint8_t>(pack_modifiers(event.modifiers) | (event.pressed ? RECORD_PRESSED : 0));
+		record(wnd, {.kind = record_kind::key, .flags = flags, .a = static_cast<int32_t>(event.keycode), .b = static_cast<int32_t>(event.keysym), .e = event.time.server});
+		flush_motion(wnd);
+		invoke(trace_scope::on_key, get_ref(wnd), wnd->on_key.fn, event);
+	}
+}
+
+static
+auto flush_resizes(std::chrono::steady_clock::time_point now) -> void {
+	static std::vector<handle> pending;
+	pending.swap(resize_pending_);
+	for (const auto h : pending) {
+		const auto wnd = get_window(h);
+		if (!wnd) {
+			continue;
+		}
+		wnd->resize_pending = false;
+		if (wnd->pending_size == wnd->size) {
+			// The window was only moved, or this is the echo of a
+			// size we set ourselves.
+			continue;
+		}
+		wnd->size = wnd->pending_size;
+		wnd->last_resize = now;
+		if (!wnd->resize_settling) {
+			wnd->resize_settling = true;
+			resize_settling_.push_back(h);
+		}
+		invoke(trace_scope::on_resizing, get_ref(wnd), wnd->on_resizing.fn, wnd->size);
+	}
+	pending.clear();
+}
+
+static
+auto settle_resizes(std::chrono::steady_clock::time_point now) -> void {
+	static std::vector<handle> settling;
+	settling.swap(resize_settling_);
+	for (const auto h : settling) {
+		const auto wnd = get_window(h);
+		if (!wnd) {
+			continue;
+		}
+		if (now - wnd->last_resize < wnd->resize_settle.value) {
+			resize_settling_.push_back(h);
+			continue;
+		}
+		wnd->resize_settling = false;
+		invoke(trace_scope::on_resized, get_ref(wnd), wnd->on_resized.fn, wnd->size);
+		resume_resized(get_ref(wnd), wnd->size);
+	}
+	settling.clear();
+}
+
+static
+auto next_settle_deadline() -> std::chrono::steady_clock::time_point {
+	auto deadline = std::chrono::steady_clock::time_point::max();
+	for (const auto h : resize_settling_) {
+		if (const auto wnd = get_window(h)) {
+			deadline = std::min(deadline, wnd->last_resize + wnd->resize_settle.value);
+		}
+	}
+	return deadline;
+}
+
+// Written to by post() to wake up app_beg().
+static
+auto get_wake_fd() -> int {
+	static const auto fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return fd;
+}
+
+auto post(edwin::function<void()> fn) -> void {
+	posted_.push(std::move(fn));
+	if (!wake_pending_.exchange(true)) {
+		// Only the first post() since the queue was last drained has
+		// to pay for the syscall.
+		const auto one = uint64_t{1};
+		[[maybe_unused]] const auto result = write(get_wake_fd(), &one, sizeof(one));
+	}
+}
+
+static
+auto run_posted() -> void {
+	if (!wake_pending_.exchange(false)) {
+		return;
+	}
+	uint64_t count;
+	[[maybe_unused]] const auto result = read(get_wake_fd(), &count, sizeof(count));
+	const auto scope = traced{trace_scope::posted};
+	edwin::function<void()> fn;
+	while (posted_.pop(&fn)) {
+		fn();
+	}
+}
+
+static
+auto record_x_error(x_error error) -> void {
+	x_errors_[x_error_count_++ % MAX_X_ERRORS] = error;
+}
+
+// issued is the serial of the last request made and processed is the
+// last one the server is known to have finished with.
+static
+auto check_x_errors(x_error_mark since, uint64_t issued, uint64_t processed, x_error* first) -> x_error_status {
+	const auto count = std::min<uint64_t>(x_error_count_, MAX_X_ERRORS);
+	if (count > 0 && x_errors_[(x_error_count_ - 1) % MAX_X_ERRORS].serial >= since.serial) {
+		if (first) {
+			for (auto i = x_error_count_ - count; i < x_error_count_; i++) {
+				if (x_errors_[i % MAX_X_ERRORS].serial >= since.serial) {
+					*first = x_errors_[i % MAX_X_ERRORS];
+					break;
+				}
+			}
+		}
+		return x_error_status::failed;
+	}
+	if (issued < since.serial || processed >= issued) {
+		return x_error_status::none;
+	}
+	return x_error_status::pending;
+}
+
+// Every pass over the event queue is wrapped in these.
+static
+auto dispatch_beg() -> bool {
+	const auto was_dispatching = dispatching_;
+	dispatching_ = true;
+	run_posted();
+	return was_dispatching;
+}
+
+static
+auto dispatch_end(bool was_dispatching) -> void {
+	// While replaying, whatever the real dispatch around it recorded
+	// waits for that dispatch to end.
+	if (!replaying_ && recorder_.has_events()) {
+		record(nullptr, {.kind = record_kind::dispatch});
+		recorder_.flush();
+	}
+	const auto now = std::chrono::steady_clock::now();
+	flush_motions();
+	flush_resizes(now);
+	flush_syncs();
+	settle_resizes(now);
+	flush_damage();
+	dispatching_ = was_dispatching;
+	if (!dispatching_) {
+		release_dead_slots();
+	}
+}
+
+static
+auto arm_timer(int timer, std::chrono::steady_clock::time_point when) -> void {
+	// steady_clock is CLOCK_MONOTONIC on Linux so the time points can be
+	// handed to the timerfd as absolute deadlines.
+	const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+	itimerspec spec = {};
+	spec.it_value.tv_sec  = ns / 1'000'000'000;
+	spec.it_value.tv_nsec = ns % 1'000'000'000;
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+		// A zero it_value would disarm the timer.
+		spec.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+static
+auto wait_for_events(int xfd, int timer) -> void {
+	// The wake fd is drained by run_posted().
+	pollfd fds[] = {
+		{xfd, POLLIN, 0},
+		{timer, POLLIN, 0},
+		{get_wake_fd(), POLLIN, 0},
+	};
+	if (poll(fds, std::size(fds), -1) < 0) {
+		return;
+	}
+	if (fds[1].revents & POLLIN) {
+		uint64_t expirations;
+		while (read(timer, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+	}
+}
+
+// Implemented by the backend. The fd is -1 if there's no connection.
+// prepare_wait() should flush the connection and return true if there
+// are events queued on the client side, which won't make the fd readable.
+static
+auto get_connection_fd() -> int;
+static
+auto prepare_wait() -> bool;
+
+// Implemented by the backend, with libXrandr or xcb-randr. Both are
+// optional (EDWIN_RANDR), and without them there are no CRTCs, so
+// frame_interval::match_display falls back to the interval.
+// open_randr() asks for screen and CRTC change notifications, and returns
+// whether the server has RandR 1.3. query_randr_crtcs() appends the CRTCs
+// which are driving something.
+static
+auto open_randr() -> bool;
+static
+auto query_randr_crtcs(std::vector<crtc>* crtcs) -> void;
+
+#if defined(EDWIN_RANDR)
+// From a mode's timings. Zero for the made up modes of a virtual
+// framebuffer.
+static
+auto get_refresh_period(uint64_t dot_clock, uint64_t h_total, uint64_t v_total, bool double_scan, bool interlace) -> std::chrono::nanoseconds {
+	if (double_scan) { v_total *= 2; }
+	if (interlace)   { v_total /= 2; }
+	if (dot_clock == 0 || h_total == 0 || v_total == 0) {
+		return {};
+	}
+	return std::chrono::nanoseconds{int64_t(h_total * v_total * 1'000'000'000 / dot_clock)};
+}
+#endif
+
+// Only asks the server again when RandR says something changed.
+static
+auto get_crtcs() -> const std::vector<crtc>& {
+	if (!randr_checked_) {
+		randr_checked_   = true;
+		randr_available_ = open_randr();
+	}
+	if (crtcs_dirty_) {
+		crtcs_dirty_ = false;
+		crtcs_.clear();
+		if (randr_available_) {
+			query_randr_crtcs(&crtcs_);
+		}
+	}
+	return crtcs_;
+}
+
+static
+auto overlaps(rect a, rect b) -> bool {
+	return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+// The refresh period of the fastest monitor which a top-level window is
+// on, or of the fastest monitor if there's no such window. Zero if RandR
+// doesn't know.
+static
+auto get_display_refresh_period() -> std::chrono::nanoseconds {
+	const auto none = std::chrono::nanoseconds::max();
+	auto fastest = none;
+	auto fastest_showing = none;
+	for (const auto& c : get_crtcs()) {
+		fastest = std::min(fastest, c.refresh_period);
+		for (const auto& [xwindow, h] : window_map_) {
+			const auto& wnd = window_slots_[h.slot];
+			if (wnd.top_level && overlaps(c.area, {wnd.root_position.x, wnd.root_position.y, wnd.size.width, wnd.size.height})) {
+				fastest_showing = std::min(fastest_showing, c.refresh_period);
+				break;
+			}
+		}
+	}
+	const auto period = fastest_showing != none ? fastest_showing : fastest;
+	return period != none ? period : std::chrono::nanoseconds{};
+}
+
+// The refresh period of the monitor which a top-level window overlaps
+// most. Zero if it isn't on one which RandR knows.
+static
+auto get_window_refresh_period(const window& wnd) -> std::chrono::nanoseconds {
+	const auto area = rect{wnd.root_position.x, wnd.root_position.y, wnd.size.width, wnd.size.height};
+	auto best = std::chrono::nanoseconds{};
+	auto best_overlap = int64_t{0};
+	for (const auto& c : get_crtcs()) {
+		const auto w = std::min(area.x + area.width, c.area.x + c.area.width) - std::max(area.x, c.area.x);
+		const auto h = std::min(area.y + area.height, c.area.y + c.area.height) - std::max(area.y, c.area.y);
+		if (w > 0 && h > 0 && int64_t{w} * h > best_overlap) {
+			best_overlap = int64_t{w} * h;
+			best = c.refresh_period;
+		}
+	}
+	return best;
+}
+
+// The period to run the app's frames at for interval, which follows the
+// display if it has match_display.
+static
+auto get_frame_period(edwin::frame_interval interval) -> frame_clock::clock::duration {
+	if (interval.match_display) {
+		if (display_dirty_) {
+			display_dirty_ = false;
+			display_refresh_period_ = get_display_refresh_period();
+		}
+		if (display_refresh_period_.count() > 0) {
+			return display_refresh_period_;
+		}
+	}
+	return interval.value;
+}
+
+// The period to run a window's frames at, which follows the monitor it's
+// on if its interval has match_display. Child windows, e.g. editors
+// embedded in a host, don't know where they are, so they go with the
+// monitors of the top-level windows like the app's frames do.
+static
+auto get_frame_period(window& wnd) -> frame_clock::clock::duration {
+	if (!wnd.top_level) {
+		return get_frame_period(wnd.frame_interval);
+	}
+	if (wnd.frame_interval.match_display) {
+		if (wnd.refresh_epoch != display_epoch_) {
+			wnd.refresh_epoch  = display_epoch_;
+			wnd.refresh_period = get_window_refresh_period(wnd);
+		}
+		if (wnd.refresh_period.count() > 0) {
+			return wnd.refresh_period;
+		}
+		return get_frame_period(wnd.frame_interval);
+	}
+	return wnd.frame_interval.value;
+}
+
+// Changing the interval doesn't move the next deadline, so it takes
+// effect from the frame after.
+static
+auto update_frame_interval() -> void {
+	if (app_active_ && app_interval_.match_display) {
+		app_frames_.interval = get_frame_period(app_interval_);
+	}
+}
+
+static
+auto is_later(const window_frame& a, const window_frame& b) -> bool {
+	return a.due > b.due;
+}
+
+static
+auto schedule_frame(const window& wnd, std::chrono::steady_clock::time_point due) -> void {
+	window_frames_.push_back({due, get_handle(wnd), wnd.frame_serial});
+	std::push_heap(window_frames_.begin(), window_frames_.end(), is_later);
+}
+
+auto set(window* ref, fn::frame cb, edwin::frame_interval interval) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_frame       = std::move(cb);
+	wnd->frame_interval = interval;
+	wnd->frame_serial++;
+	if (wnd->on_frame.fn) {
+		schedule_frame(*wnd, std::chrono::steady_clock::now() + get_frame_period(*wnd));
+	}
+}
+
+// Runs every window frame which is due, all in one pass. Missed frames are
+// skipped, keeping each window on its original phase.
+static
+auto run_window_frames() -> void {
+	static std::vector<window_frame> due;
+	const auto now = std::chrono::steady_clock::now();
+	while (!window_frames_.empty() && window_frames_.front().due <= now + WINDOW_FRAME_SLACK) {
+		std::pop_heap(window_frames_.begin(), window_frames_.end(), is_later);
+		due.push_back(window_frames_.back());
+		window_frames_.pop_back();
+	}
+	if (due.empty()) {
+		return;
+	}
+	// A frame callback may destroy its window, in which case the slot is
+	// released once they have all run.
+	const auto was_dispatching = std::exchange(dispatching_, true);
+	for (const auto& entry : due) {
+		const auto wnd = get_window(entry.wnd);
+		if (!wnd || wnd->frame_serial != entry.serial) {
+			continue;
+		}
+		// Moved out for the call in case the callback replaces itself.
+		auto frame = std::move(wnd->on_frame);
+		invoke(trace_scope::frame, get_ref(wnd), frame.fn);
+		if (get_window(entry.wnd) != wnd || wnd->frame_serial != entry.serial) {
+			continue;
+		}
+		wnd->on_frame = std::move(frame);
+		const auto period = std::max<frame_clock::clock::duration>(get_frame_period(*wnd), WINDOW_FRAME_SLACK);
+		const auto after  = std::chrono::steady_clock::now();
+		auto next = entry.due + period;
+		if (next <= after) {
+			next += ((after - next) / period + 1) * period;
+		}
+		schedule_frame(*wnd, next);
+	}
+	due.clear();
+	dispatching_ = was_dispatching;
+	if (!dispatching_) {
+		release_dead_slots();
+	}
+}
+
+static
+auto start_frames(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	app_schedule_stop_ = false;
+	app_active_        = true;
+	app_frame_         = std::move(frame);
+	app_interval_      = interval;
+	app_frames_        = frame_clock{interval.value, overrun};
+	update_frame_interval();
+	reset_frame_stats();
+}
+
+static
+auto stop_frames() -> void {
+	app_active_ = false;
+	app_frame_  = {};
+}
+
+auto next_deadline() -> std::chrono::steady_clock::time_point {
+	auto deadline = next_settle_deadline();
+	if (app_active_) {
+		deadline = std::min(deadline, app_frames_.next);
+	}
+	if (!window_frames_.empty()) {
+		deadline = std::min(deadline, window_frames_.front().due);
+	}
+	return deadline;
+}
+
+auto poll_fds() -> std::span<const int> {
+	static int fds[2];
+	fds[0] = get_connection_fd();
+	fds[1] = get_wake_fd();
+	return {fds, fds[0] < 0 ? 0u : 2u};
+}
+
+auto dispatch_ready() -> void {
+	const auto xfd = get_connection_fd();
+	if (xfd < 0) {
+		return;
+	}
+	pollfd fds[] = {
+		{xfd, POLLIN, 0},
+		{get_wake_fd(), POLLIN, 0},
+	};
+	const auto readable = poll(fds, std::size(fds), 0) > 0;
+	if (readable || std::chrono::steady_clock::now() >= next_settle_deadline()) {
+		process_messages();
+	}
+	if (app_active_) {
+		update_frame_interval();
+		if (app_schedule_stop_) {
+			stop_frames();
+		}
+		else {
+			app_frames_.run_due(app_frame_);
+		}
+	}
+	run_window_frames();
+	// Anything read off the socket while waiting for a reply, e.g. during
+	// a frame, wouldn't wake up the host's poll.
+	while (prepare_wait()) {
+		process_messages();
+	}
+}
+
+auto app_attach(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	start_frames(std::move(frame), interval, overrun);
+}
+
+// The app_beg() loop.
+static
+auto run_app(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	const auto xfd = get_connection_fd();
+	if (xfd < 0) {
+		return;
+	}
+	const auto timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timer < 0) {
+		return;
+	}
+	start_frames(std::move(frame), interval, overrun);
+	auto armed = std::chrono::steady_clock::time_point{};
+	for (;;) {
+		process_messages();
+		if (app_schedule_stop_) {
+			break;
+		}
+		update_frame_interval();
+		if (app_frames_.run_due(app_frame_) && app_schedule_stop_) {
+			break;
+		}
+		run_window_frames();
+		if (app_schedule_stop_) {
+			break;
+		}
+		const auto deadline = next_deadline();
+		if (deadline != armed) {
+			arm_timer(timer, deadline);
+			armed = deadline;
+		}
+		if (!prepare_wait()) {
+			wait_for_events(xfd, timer);
+		}
+	}
+	stop_frames();
+	close(timer);
+}
+
+auto record_events(const char* path) -> bool {
+	if (!recorder_.open(path)) {
+		return false;
+	}
+	record_start_ = std::chrono::steady_clock::now();
+	record_base_  = get_oldest_ordinal();
+	return true;
+}
+
+auto stop_recording() -> void {
+	recorder_.close();
+}
+
+static
+auto replay(const event_record& r, window* wnd) -> void {
+	const auto xwindow = wnd->xwindow;
+	const auto mods    = unpack_modifiers(r.flags);
+	const auto pressed = (r.flags & RECORD_PRESSED) != 0;
+	const auto time    = make_input_time(r.e);
+	switch (r.kind) {
+		case record_kind::configure:    { on_notify_configure(xwindow, {r.c, r.d}, {r.a, r.b}, (r.flags & RECORD_SYNTHETIC) != 0); break; }
+		// Only the notification. The window is real, and stays open
+		// unless on_closed destroys it.
+		case record_kind::destroy:      { invoke(trace_scope::on_closed, get_ref(wnd), wnd->on_closed.fn); break; }
+		case record_kind::expose:       { on_notify_expose(xwindow, {r.a, r.b, r.c, r.d}, static_cast<int>(r.e)); break; }
+		case record_kind::sync_request: { on_sync_request(xwindow, static_cast<int64_t>(uint64_t(uint32_t(r.a)) | (uint64_t(uint32_t(r.b)) << 32))); break; }
+		case record_kind::motion:       { on_input_motion(xwindow, {{r.a, r.b}, mods, time}); break; }
+		case record_kind::button:       { on_input_button(xwindow, static_cast<unsigned int>(r.c), pressed, {r.a, r.b}, mods, time); break; }
+		case record_kind::key:          { on_input_key(xwindow, {uint32_t(r.a), uint32_t(r.b), pressed, mods, time}); break; }
+		default:                        { break; }
+	}
+}
+
+// Windows are looked up by creation order. Events for windows which don't
+// exist (because the application didn't open the same ones) are skipped.
+auto replay_events(const char* path, replay_speed speed) -> bool {
+	auto records = std::vector<event_record>{};
+	if (!read_recording(path, &records)) {
+		return false;
+	}
+	const auto base  = get_oldest_ordinal();
+	const auto start = std::chrono::steady_clock::now();
+	const auto was_replaying = std::exchange(replaying_, true);
+	auto windows = std::unordered_map<uint32_t, handle>{};
+	const auto find = [&windows, base](uint32_t index) -> window* {
+		if (const auto pos = windows.find(index); pos != windows.end()) {
+			if (const auto wnd = get_window(pos->second)) {
+				return wnd;
+			}
+		}
+		for (const auto& [xwindow, h] : window_map_) {
+			if (window_slots_[h.slot].ordinal == base + index) {
+				windows[index] = h;
+				return &window_slots_[h.slot];
+			}
+		}
+		return nullptr;
+	};
+	for (size_t i = 0; i < records.size(); i++) {
+		if (speed == replay_speed::real_time) {
+			std::this_thread::sleep_until(start + std::chrono::nanoseconds{records[i].time});
+		}
+		const auto scope = traced{trace_scope::dispatch};
+		const auto was_dispatching = dispatch_beg();
+		for (; i < records.size() && records[i].kind != record_kind::dispatch; i++) {
+			if (const auto wnd = find(records[i].window)) {
+				replay(records[i], wnd);
+			}
+		}
+		dispatch_end(was_dispatching);
+	}
+	replaying_ = was_replaying;
+	return true;
+}
+
+} // edwin
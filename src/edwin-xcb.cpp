@@ -0,0 +1,985 @@
+#include "edwin-icon.hpp"
+#include "edwin-surface.hpp"
+#include "edwin-x11.hpp"
+#include "edwin-post.hpp"
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <sys/uio.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#if defined(EDWIN_RANDR)
+#include <xcb/randr.h>
+#endif
+
+// Alternative Linux backend which talks to the X server through XCB
+// instead of Xlib. Requests which need a reply are issued all at once
+// and the replies collected afterwards, so a batch of them costs a
+// single round trip instead of one each.
+
+namespace edwin {
+
+// WM_SIZE_HINTS as laid out in the ICCCM. Xlib hides this behind
+// XSetWMNormalHints() and there is no xcb-icccm dependency here.
+struct wm_size_hints {
+	uint32_t flags;
+	int32_t x, y, width, height;
+	int32_t min_width, min_height;
+	int32_t max_width, max_height;
+	int32_t width_inc, height_inc;
+	int32_t min_aspect_num, min_aspect_den;
+	int32_t max_aspect_num, max_aspect_den;
+	int32_t base_width, base_height;
+	uint32_t win_gravity;
+};
+
+static constexpr uint32_t P_MIN_SIZE = 1 << 4;
+static constexpr uint32_t P_MAX_SIZE = 1 << 5;
+
+struct connection {
+	xcb_connection_t* xcb = nullptr;
+	xcb_screen_t* screen  = nullptr;
+	xcb_atom_t atoms[size_t(atom::count)] = {};
+	// Fetched the first time a key event arrives, and again after the
+	// keyboard mapping changes.
+	std::vector<xcb_keysym_t> keysyms;
+	xcb_keycode_t min_keycode = 0;
+	uint8_t keysyms_per_keycode = 0;
+	// Whether the SYNC extension is there for _NET_WM_SYNC_REQUEST.
+	bool sync = false;
+	// The connection belongs to the host (set_xcb_connection()), which
+	// also owns the event queue.
+	bool shared = false;
+	// Sequence numbers are widened to 64 bits like Xlib's serials, against
+	// the latest one seen, so they keep going up after XCB's wrap around.
+	uint64_t last_sequence = 0;
+	// The last request the server is known to have processed, going by
+	// the events and replies read so far.
+	uint64_t processed = 0;
+	// The GetInputFocus which check_x_errors() is waiting on, if any, and
+	// the sequence number of the latest one sent.
+	xcb_get_input_focus_cookie_t probe = {};
+	uint64_t probe_sequence = 0;
+	// RandR's first event, once open_randr() has found it.
+	int randr_event_base = -1;
+};
+
+// There is no xcb-sync dependency here either. The few SYNC requests we
+// need are simple enough to send by hand.
+static xcb_extension_t sync_extension_ = {"SYNC", 0};
+
+static constexpr uint8_t SYNC_INITIALIZE      = 0;
+static constexpr uint8_t SYNC_CREATE_COUNTER  = 2;
+static constexpr uint8_t SYNC_SET_COUNTER     = 3;
+static constexpr uint8_t SYNC_DESTROY_COUNTER = 6;
+
+// An event which was pulled off the queue while checking whether we can
+// block, and which still needs to be dispatched.
+static xcb_generic_event_t* stashed_event_ = nullptr;
+
+static
+auto intern_atoms(connection* c) -> void {
+	xcb_intern_atom_cookie_t cookies[size_t(atom::count)];
+	for (size_t i = 0; i < size_t(atom::count); i++) {
+		cookies[i] = xcb_intern_atom(c->xcb, 0, static_cast<uint16_t>(std::strlen(atom_names[i])), atom_names[i]);
+	}
+	for (size_t i = 0; i < size_t(atom::count); i++) {
+		if (const auto reply = xcb_intern_atom_reply(c->xcb, cookies[i], nullptr)) {
+			c->atoms[i] = reply->atom;
+			std::free(reply);
+		}
+	}
+}
+
+// For extension requests we send by hand. words[0] is left for the
+// request header, which XCB fills in.
+static
+auto send_request(xcb_connection_t* xcb, xcb_extension_t* ext, uint8_t opcode, uint32_t* words, size_t count, bool reply) -> unsigned int {
+	struct iovec parts[3];
+	parts[2].iov_base = words;
+	parts[2].iov_len  = count * sizeof(uint32_t);
+	const auto request = xcb_protocol_request_t{1, ext, opcode, uint8_t(!reply)};
+	// XCB needs the two iovecs before ours for its own use.
+	return xcb_send_request(xcb, 0, parts + 2, &request);
+}
+
+static
+auto init_sync(connection* c) -> void {
+	const auto ext = xcb_get_extension_data(c->xcb, &sync_extension_);
+	if (!ext || !ext->present) {
+		return;
+	}
+	// The version has to be negotiated before any other SYNC request.
+	const uint8_t version[4] = {3, 1, 0, 0};
+	uint32_t words[2] = {};
+	std::memcpy(&words[1], version, sizeof(version));
+	xcb_discard_reply(c->xcb, send_request(c->xcb, &sync_extension_, SYNC_INITIALIZE, words, 2, true));
+	c->sync = true;
+}
+
+static
+auto send_counter_request(xcb_connection_t* xcb, uint8_t opcode, uint32_t counter, int64_t value) -> void {
+	uint32_t words[4] = {0, counter, static_cast<uint32_t>(static_cast<uint64_t>(value) >> 32), static_cast<uint32_t>(value)};
+	send_request(xcb, &sync_extension_, opcode, words, 4, false);
+}
+
+static connection connection_;
+static bool connection_opened_ = false;
+
+static
+auto init_connection(xcb_connection_t* xcb, int screen_index) -> void {
+	auto& c = connection_;
+	c.xcb = xcb;
+	auto it = xcb_setup_roots_iterator(xcb_get_setup(c.xcb));
+	for (auto i = 0; i < screen_index; i++) {
+		xcb_screen_next(&it);
+	}
+	c.screen = it.data;
+	intern_atoms(&c);
+	init_sync(&c);
+}
+
+static
+auto get_connection() -> connection* {
+	if (!connection_.xcb && !std::exchange(connection_opened_, true)) {
+		auto screen_index = 0;
+		const auto xcb = xcb_connect(nullptr, &screen_index);
+		if (xcb_connection_has_error(xcb)) {
+			xcb_disconnect(xcb);
+		}
+		else {
+			init_connection(xcb, screen_index);
+		}
+	}
+	return connection_.xcb ? &connection_ : nullptr;
+}
+
+auto get_xcb_connection() -> xcb_connection_t* {
+	const auto c = get_connection();
+	return c ? c->xcb : nullptr;
+}
+
+auto set_xcb_connection(xcb_connection_t* xcb, int screen_index) -> void {
+	if (connection_.xcb || !xcb) {
+		return;
+	}
+	connection_opened_ = true;
+	connection_.shared = true;
+	init_connection(xcb, screen_index);
+}
+
+#if defined(EDWIN_RANDR)
+static
+auto open_randr() -> bool {
+	const auto c = get_connection();
+	const auto ext = xcb_get_extension_data(c->xcb, &xcb_randr_id);
+	if (!ext || !ext->present) {
+		return false;
+	}
+	// GetScreenResourcesCurrent is new in 1.3, and the server only sends
+	// CRTC changes to clients which asked for at least 1.2.
+	const auto version = xcb_randr_query_version_reply(c->xcb, xcb_randr_query_version(c->xcb, 1, 3), nullptr);
+	if (!version) {
+		return false;
+	}
+	const auto new_enough = version->major_version > 1 || (version->major_version == 1 && version->minor_version >= 3);
+	std::free(version);
+	if (!new_enough) {
+		return false;
+	}
+	c->randr_event_base = ext->first_event;
+	xcb_randr_select_input(c->xcb, c->screen->root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE | XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE);
+	return true;
+}
+
+// One round trip for the resources and one for all of the CRTCs.
+static
+auto query_randr_crtcs(std::vector<crtc>* crtcs) -> void {
+	const auto c = get_connection();
+	const auto resources = xcb_randr_get_screen_resources_current_reply(c->xcb, xcb_randr_get_screen_resources_current(c->xcb, c->screen->root), nullptr);
+	if (!resources) {
+		return;
+	}
+	const auto crtc_ids   = xcb_randr_get_screen_resources_current_crtcs(resources);
+	const auto crtc_count = xcb_randr_get_screen_resources_current_crtcs_length(resources);
+	const auto modes      = xcb_randr_get_screen_resources_current_modes(resources);
+	const auto mode_count = xcb_randr_get_screen_resources_current_modes_length(resources);
+	auto cookies = std::vector<xcb_randr_get_crtc_info_cookie_t>(size_t(crtc_count));
+	for (auto i = 0; i < crtc_count; i++) {
+		cookies[i] = xcb_randr_get_crtc_info(c->xcb, crtc_ids[i], resources->config_timestamp);
+	}
+	for (const auto cookie : cookies) {
+		const auto info = xcb_randr_get_crtc_info_reply(c->xcb, cookie, nullptr);
+		if (!info) {
+			continue;
+		}
+		// Mode 0 isn't driving anything.
+		for (auto m = 0; info->mode && m < mode_count; m++) {
+			const auto& mode = modes[m];
+			if (mode.id != info->mode) {
+				continue;
+			}
+			const auto period = get_refresh_period(mode.dot_clock, mode.htotal, mode.vtotal, mode.mode_flags & XCB_RANDR_MODE_FLAG_DOUBLE_SCAN, mode.mode_flags & XCB_RANDR_MODE_FLAG_INTERLACE);
+			if (period.count() > 0) {
+				crtcs->push_back({{info->x, info->y, info->width, info->height}, period});
+			}
+			break;
+		}
+		std::free(info);
+	}
+	std::free(resources);
+}
+#else
+static
+auto open_randr() -> bool {
+	return false;
+}
+
+static
+auto query_randr_crtcs(std::vector<crtc>*) -> void {}
+#endif
+
+// The two RandR events are ScreenChangeNotify and Notify, which carries
+// CRTC changes among other things.
+static
+auto is_randr_event(const xcb_generic_event_t& event) -> bool {
+	const auto base = get_connection()->randr_event_base;
+	const auto type = event.response_type & ~0x80;
+	return base >= 0 && (type == base || type == base + 1);
+}
+
+static
+auto get_atom(const connection& c, atom a) -> xcb_atom_t {
+	return c.atoms[size_t(a)];
+}
+
+// Handle WM_DELETE_WINDOW ourselves instead of letting the window manager
+// kill the connection, and take part in _NET_WM_SYNC_REQUEST if we can.
+static
+auto write_protocols(const connection& c, window* wnd) -> void {
+	const auto xwindow = static_cast<xcb_window_t>(wnd->xwindow);
+	xcb_atom_t protocols[2] = {get_atom(c, atom::wm_delete_window)};
+	uint32_t count = 1;
+	if (c.sync) {
+		wnd->sync_counter = xcb_generate_id(c.xcb);
+		send_counter_request(c.xcb, SYNC_CREATE_COUNTER, wnd->sync_counter, 0);
+		xcb_change_property(c.xcb, XCB_PROP_MODE_REPLACE, xwindow, get_atom(c, atom::net_wm_sync_request_counter), XCB_ATOM_CARDINAL, 32, 1, &wnd->sync_counter);
+		protocols[count++] = get_atom(c, atom::net_wm_sync_request);
+	}
+	xcb_change_property(c.xcb, XCB_PROP_MODE_REPLACE, xwindow, get_atom(c, atom::wm_protocols), XCB_ATOM_ATOM, 32, count, protocols);
+}
+
+static
+auto write_sync_counter(window* wnd, int64_t value) -> void {
+	send_counter_request(get_connection()->xcb, SYNC_SET_COUNTER, wnd->sync_counter, value);
+}
+
+auto destroy(window* ref) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	const auto c = get_connection();
+	if (!c) { return; }
+	if (wnd->sync_counter) {
+		uint32_t words[2] = {0, wnd->sync_counter};
+		send_request(c->xcb, &sync_extension_, SYNC_DESTROY_COUNTER, words, 2, false);
+	}
+	xcb_destroy_window(c->xcb, static_cast<xcb_window_t>(wnd->xwindow));
+	remove_window(wnd);
+}
+
+auto get_native_handle(const window& w) -> native_handle {
+	const auto wnd = get_window(&w);
+	return native_handle{wnd ? (void*)(wnd->xwindow) : nullptr};
+}
+
+auto get_xwindow(const window& w) -> Window {
+	const auto wnd = get_window(&w);
+	return wnd ? wnd->xwindow : 0;
+}
+
+// Format 32 properties are sent as 32-bit values on the wire, unlike
+// Xlib which wants them in longs.
+static icon_cache<uint32_t> icon_cache_;
+
+static
+auto write_icons(window* wnd, std::span<const edwin::icon> icons) -> void {
+	static std::vector<edwin::icon> valid;
+	valid.clear();
+	for (const auto& icon : icons) {
+		if (is_valid(icon)) {
+			valid.push_back(icon);
+		}
+	}
+	if (valid.empty()) {
+		return;
+	}
+	const auto c = get_connection();
+	const auto& icon_data = icon_cache_.get(valid);
+	xcb_change_property(c->xcb, XCB_PROP_MODE_REPLACE, static_cast<xcb_window_t>(wnd->xwindow), get_atom(*c, atom::net_wm_icon), XCB_ATOM_CARDINAL, 32, static_cast<uint32_t>(icon_data.size()), icon_data.data());
+}
+
+static
+auto write_size_hints(window* wnd) -> void {
+	auto hints = wm_size_hints{};
+	hints.flags = P_MIN_SIZE | P_MAX_SIZE;
+	if (wnd->resizable.value) {
+		hints.min_width  = MIN_SIZE;
+		hints.min_height = MIN_SIZE;
+		hints.max_width  = MAX_SIZE;
+		hints.max_height = MAX_SIZE;
+	}
+	else {
+		hints.min_width = hints.max_width = wnd->size.width;
+		hints.min_height = hints.max_height = wnd->size.height;
+	}
+	const auto c = get_connection();
+	const auto length = static_cast<uint32_t>(sizeof(hints) / sizeof(uint32_t));
+	xcb_change_property(c->xcb, XCB_PROP_MODE_REPLACE, static_cast<xcb_window_t>(wnd->xwindow), XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 32, length, &hints);
+}
+
+static
+auto write_title(window* wnd, edwin::title title) -> void {
+	const auto c = get_connection();
+	const auto xwindow = static_cast<xcb_window_t>(wnd->xwindow);
+	const auto length = static_cast<uint32_t>(title.value.size());
+	xcb_change_property(c->xcb, XCB_PROP_MODE_REPLACE, xwindow, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, length, title.value.data());
+	xcb_change_property(c->xcb, XCB_PROP_MODE_REPLACE, xwindow, get_atom(*c, atom::net_wm_name), get_atom(*c, atom::utf8_string), 8, length, title.value.data());
+}
+
+static
+auto write_visible(window* wnd, edwin::visible visible) -> void {
+	const auto c = get_connection();
+	const auto xwindow = static_cast<xcb_window_t>(wnd->xwindow);
+	if (visible.value) {
+		xcb_map_window(c->xcb, xwindow);
+		return;
+	}
+	// Withdrawn properly (ICCCM 4.1.4) so that the window manager treats the
+	// next map as a new window, e.g. when it comes back out of a pool. This
+	// is what XWithdrawWindow() does.
+	xcb_unmap_window(c->xcb, xwindow);
+	xcb_unmap_notify_event_t event = {};
+	event.response_type  = XCB_UNMAP_NOTIFY;
+	event.event          = c->screen->root;
+	event.window         = xwindow;
+	event.from_configure = 0;
+	// xcb_send_event() always sends 32 bytes.
+	char buffer[32] = {};
+	std::memcpy(buffer, &event, sizeof(event));
+	const auto mask = XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+	xcb_send_event(c->xcb, 0, c->screen->root, mask, buffer);
+}
+
+// Everything create() does except flushing the connection, so that
+// create_many() can flush once for all of the windows.
+static
+auto create_window(window_config cfg) -> window* {
+	const auto c = get_connection();
+	const auto parent = cfg.parent.value ? (xcb_window_t)(uintptr_t)(cfg.parent.value) : c->screen->root;
+	const auto border_width = 0;
+	const auto xwindow = xcb_generate_id(c->xcb);
+	// Same defaults as XCreateSimpleWindow(), and the event mask is set
+	// here rather than with a separate request.
+	const uint32_t mask = XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK;
+	const uint32_t values[] = {c->screen->white_pixel, c->screen->black_pixel, XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_EXPOSURE | INPUT_EVENT_MASK};
+	xcb_create_window(c->xcb, XCB_COPY_FROM_PARENT, xwindow, parent,
+		static_cast<int16_t>(cfg.position.x), static_cast<int16_t>(cfg.position.y),
+		static_cast<uint16_t>(cfg.size.width), static_cast<uint16_t>(cfg.size.height),
+		border_width, XCB_WINDOW_CLASS_INPUT_OUTPUT, c->screen->root_visual, mask, values);
+	const auto wnd = add_window(xwindow, cfg);
+	if (!wnd) {
+		xcb_destroy_window(c->xcb, xwindow);
+		return nullptr;
+	}
+	const auto ref = get_ref(wnd);
+	write_protocols(*c, wnd);
+	set(ref, std::move(cfg.on_closed));
+	set(ref, std::move(cfg.on_damaged));
+	set(ref, std::move(cfg.on_resized));
+	set(ref, std::move(cfg.on_resizing));
+	set(ref, std::move(cfg.on_key));
+	set(ref, std::move(cfg.on_mouse_button));
+	set(ref, std::move(cfg.on_mouse_move));
+	set(ref, std::move(cfg.on_mouse_wheel));
+	set(ref, cfg.compress_motion);
+	set(ref, cfg.resize_settle);
+	set(ref, cfg.resize_sync);
+	// The position and size were set by xcb_create_window().
+	wnd->resizable = cfg.resizable;
+	write_size_hints(wnd);
+	write_title(wnd, cfg.title);
+	if (cfg.icons.value.empty()) { write_icons(wnd, {&cfg.icon, 1}); }
+	else                         { write_icons(wnd, cfg.icons.value); }
+	if (cfg.visible.value) {
+		// Mapped last so that the window manager sees the final
+		// properties when the window first appears. A new window is
+		// already unmapped, so there's nothing to withdraw otherwise.
+		write_visible(wnd, cfg.visible);
+	}
+	return ref;
+}
+
+auto create(window_config cfg) -> window* {
+	const auto c = get_connection();
+	if (!c) {
+		return nullptr;
+	}
+	const auto scope = traced{trace_scope::create};
+	const auto wnd = create_window(std::move(cfg));
+	xcb_flush(c->xcb);
+	return wnd;
+}
+
+auto create_many(std::span<window_config> cfgs) -> std::vector<window*> {
+	auto windows = std::vector<window*>(cfgs.size());
+	const auto c = get_connection();
+	if (!c) {
+		return windows;
+	}
+	const auto scope = traced{trace_scope::create};
+	for (size_t i = 0; i < cfgs.size(); i++) {
+		windows[i] = create_window(std::move(cfgs[i]));
+	}
+	xcb_flush(c->xcb);
+	return windows;
+}
+
+static
+auto configure(window* wnd, const edwin::position* position, const edwin::size* size) -> void {
+	// Values have to be in the same order as the mask bits.
+	uint32_t values[4];
+	auto mask = uint16_t{0};
+	auto n = 0;
+	if (position) {
+		values[n++] = static_cast<uint32_t>(position->x);
+		values[n++] = static_cast<uint32_t>(position->y);
+		mask |= XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
+	}
+	if (size) {
+		values[n++] = static_cast<uint32_t>(size->width);
+		values[n++] = static_cast<uint32_t>(size->height);
+		mask |= XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+	}
+	const auto c = get_connection();
+	xcb_configure_window(c->xcb, static_cast<xcb_window_t>(wnd->xwindow), mask, values);
+}
+
+auto set(window* ref, edwin::icon icon) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_icons(wnd, {&icon, 1});
+}
+
+auto set(window* ref, edwin::icons icons) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_icons(wnd, icons.value);
+}
+
+auto set(window* ref, edwin::position position) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	configure(wnd, &position, nullptr);
+}
+
+auto set(window* ref, edwin::position position, edwin::size size) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->size = size;
+	write_size_hints(wnd);
+	configure(wnd, &position, &size);
+}
+
+auto set(window* ref, edwin::resizable resizable) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->resizable = resizable;
+	write_size_hints(wnd);
+}
+
+auto set(window* ref, edwin::resize_settle settle) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->resize_settle = settle;
+}
+
+auto set(window* ref, edwin::resize_sync sync) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->resize_sync = sync;
+}
+
+auto set(window* ref, edwin::size size) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->size = size;
+	write_size_hints(wnd);
+	configure(wnd, nullptr, &size);
+}
+
+auto set(window* ref, edwin::title title) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_title(wnd, title);
+}
+
+auto set(window* ref, edwin::visible visible) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	write_visible(wnd, visible);
+}
+
+auto set(window* ref, fn::on_window_closed cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_closed = std::move(cb);
+}
+
+auto set(window* ref, fn::on_window_damaged cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_damaged = std::move(cb);
+}
+
+auto set(window* ref, fn::on_window_resized cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_resized = std::move(cb);
+}
+
+auto set(window* ref, fn::on_window_resizing cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_resizing = std::move(cb);
+}
+
+auto set(window* ref, edwin::compress_motion compress) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->compress_motion = compress;
+}
+
+auto set(window* ref, fn::on_key cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_key = std::move(cb);
+}
+
+auto set(window* ref, fn::on_mouse_button cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_mouse_button = std::move(cb);
+}
+
+auto set(window* ref, fn::on_mouse_move cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_mouse_move = std::move(cb);
+}
+
+auto set(window* ref, fn::on_mouse_wheel cb) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	wnd->on_mouse_wheel = std::move(cb);
+}
+
+auto batch::commit() -> void {
+	if (const auto wnd = get_window(wnd_)) {
+		if (resizable_) { wnd->resizable = *resizable_; }
+		if (size_)      { wnd->size = *size_; }
+		if (resizable_ || size_) {
+			// Written once even if both changed.
+			write_size_hints(wnd);
+		}
+		if (position_ || size_) {
+			configure(wnd, position_ ? &*position_ : nullptr, size_ ? &*size_ : nullptr);
+		}
+		if (title_) { write_title(wnd, *title_); }
+		if (icon_)  { write_icons(wnd, {&*icon_, 1}); }
+		if (icons_) { write_icons(wnd, icons_->value); }
+		if (visible_) {
+			// Mapped last so that the window manager sees the final
+			// properties when the window first appears.
+			write_visible(wnd, *visible_);
+		}
+		xcb_flush(get_connection()->xcb);
+	}
+	*this = batch{wnd_};
+}
+
+// There's no xcb/shm.h dependency here, so surfaces are always presented
+// with core PutImage requests.
+struct surface {
+	handle wnd;
+	xcb_gcontext_t gc = 0;
+	surface_pixels pixels;
+	// One dirty rect at a time, converted to the X format.
+	std::vector<uint32_t> scratch;
+};
+
+static
+auto find_visual(const connection& c, xcb_visualid_t id) -> const xcb_visualtype_t* {
+	for (auto depths = xcb_screen_allowed_depths_iterator(c.screen); depths.rem; xcb_depth_next(&depths)) {
+		for (auto visuals = xcb_depth_visuals_iterator(depths.data); visuals.rem; xcb_visualtype_next(&visuals)) {
+			if (visuals.data->visual_id == id) {
+				return visuals.data;
+			}
+		}
+	}
+	return nullptr;
+}
+
+static
+auto get_bits_per_pixel(const connection& c, uint8_t depth) -> int {
+	const auto setup = xcb_get_setup(c.xcb);
+	for (auto formats = xcb_setup_pixmap_formats_iterator(setup); formats.rem; xcb_format_next(&formats)) {
+		if (formats.data->depth == depth) {
+			return formats.data->bits_per_pixel;
+		}
+	}
+	return 0;
+}
+
+auto create_surface(window* ref) -> surface* {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return nullptr; }
+	const auto c = get_connection();
+	const auto visual = find_visual(*c, c->screen->root_visual);
+	if (!visual || visual->red_mask != 0xff0000 || visual->green_mask != 0xff00 || visual->blue_mask != 0xff) {
+		// Only 24-bit TrueColor visuals are supported.
+		return nullptr;
+	}
+	const auto native_order = std::endian::native == std::endian::little ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST;
+	if (get_bits_per_pixel(*c, c->screen->root_depth) != 32 || xcb_get_setup(c->xcb)->image_byte_order != native_order) {
+		// Unlike Xlib, XCB doesn't convert images for us.
+		return nullptr;
+	}
+	const auto surf = new surface;
+	surf->wnd = get_handle(*wnd);
+	surf->gc  = xcb_generate_id(c->xcb);
+	xcb_create_gc(c->xcb, surf->gc, static_cast<xcb_window_t>(wnd->xwindow), 0, nullptr);
+	return surf;
+}
+
+auto destroy(surface* surf) -> void {
+	if (!surf) { return; }
+	xcb_free_gc(get_connection()->xcb, surf->gc);
+	delete surf;
+}
+
+auto acquire(surface* surf) -> std::span<rgba> {
+	const auto wnd = get_window(surf->wnd);
+	if (!wnd) { return {}; }
+	resize(&surf->pixels, wnd->size);
+	return surf->pixels.data;
+}
+
+auto get_size(const surface& surf) -> edwin::size {
+	return surf.pixels.size;
+}
+
+auto present(surface* surf, std::span<const rect> dirty) -> void {
+	const auto wnd = get_window(surf->wnd);
+	if (!wnd) { return; }
+	const auto c = get_connection();
+	const auto xwindow = static_cast<xcb_window_t>(wnd->xwindow);
+	// Large rects have to be split into bands of rows to fit in a request.
+	// The length is in 4-byte units and includes the 24-byte header.
+	const auto max_bytes = size_t(xcb_get_maximum_request_length(c->xcb)) * 4 - 24;
+	for_each_dirty(surf->pixels, dirty, [&](rect r) {
+		surf->scratch.resize(size_t(r.width) * size_t(r.height));
+		convert(surf->pixels, r, surf->scratch.data(), r.width);
+		const auto row_bytes = size_t(r.width) * 4;
+		const auto band = std::max(1, int(max_bytes / row_bytes));
+		for (auto y = 0; y < r.height; y += band) {
+			const auto rows = std::min(band, r.height - y);
+			xcb_put_image(c->xcb, XCB_IMAGE_FORMAT_Z_PIXMAP, xwindow, surf->gc,
+				static_cast<uint16_t>(r.width), static_cast<uint16_t>(rows),
+				static_cast<int16_t>(r.x), static_cast<int16_t>(r.y + y), 0, c->screen->root_depth,
+				static_cast<uint32_t>(row_bytes * rows), reinterpret_cast<const uint8_t*>(surf->scratch.data() + size_t(y) * size_t(r.width)));
+		}
+	});
+	xcb_flush(c->xcb);
+}
+
+// Only for the events we handle. The window isn't in the same place in
+// every event.
+static
+auto event_window(const xcb_generic_event_t& event) -> Window {
+	switch (event.response_type & ~0x80) {
+		case XCB_CONFIGURE_NOTIFY: { return reinterpret_cast<const xcb_configure_notify_event_t&>(event).window; }
+		case XCB_REPARENT_NOTIFY:  { return reinterpret_cast<const xcb_reparent_notify_event_t&>(event).window; }
+		case XCB_DESTROY_NOTIFY:   { return reinterpret_cast<const xcb_destroy_notify_event_t&>(event).window; }
+		case XCB_EXPOSE:           { return reinterpret_cast<const xcb_expose_event_t&>(event).window; }
+		case XCB_CLIENT_MESSAGE:   { return reinterpret_cast<const xcb_client_message_event_t&>(event).window; }
+		case XCB_MOTION_NOTIFY:    { return reinterpret_cast<const xcb_motion_notify_event_t&>(event).event; }
+		case XCB_BUTTON_PRESS:
+		case XCB_BUTTON_RELEASE:   { return reinterpret_cast<const xcb_button_press_event_t&>(event).event; }
+		case XCB_KEY_PRESS:
+		case XCB_KEY_RELEASE:      { return reinterpret_cast<const xcb_key_press_event_t&>(event).event; }
+		default:                   { return 0; }
+	}
+}
+
+// The unshifted keysym, like XLookupKeysym(event, 0).
+static
+auto get_keysym(xcb_keycode_t keycode) -> uint32_t {
+	const auto c = get_connection();
+	if (c->keysyms.empty()) {
+		const auto setup = xcb_get_setup(c->xcb);
+		const auto count = static_cast<uint8_t>(setup->max_keycode - setup->min_keycode + 1);
+		const auto cookie = xcb_get_keyboard_mapping(c->xcb, setup->min_keycode, count);
+		const auto reply = xcb_get_keyboard_mapping_reply(c->xcb, cookie, nullptr);
+		if (!reply) {
+			return 0;
+		}
+		const auto keysyms = xcb_get_keyboard_mapping_keysyms(reply);
+		c->keysyms.assign(keysyms, keysyms + xcb_get_keyboard_mapping_keysyms_length(reply));
+		c->min_keycode = setup->min_keycode;
+		c->keysyms_per_keycode = reply->keysyms_per_keycode;
+		std::free(reply);
+	}
+	const auto index = size_t(keycode - c->min_keycode) * c->keysyms_per_keycode;
+	return keycode >= c->min_keycode && index < c->keysyms.size() ? c->keysyms[index] : 0;
+}
+
+// Whichever 64 bit number with these low 32 bits is nearest to the latest
+// sequence seen. Requests are never that far apart.
+static
+auto widen_sequence(connection* c, uint32_t sequence) -> uint64_t {
+	auto wide = (c->last_sequence & ~uint64_t{0xffffffff}) | sequence;
+	if (wide + 0x80000000 < c->last_sequence)                          { wide += 0x100000000; }
+	else if (wide > c->last_sequence + 0x80000000 && wide > 0xffffffff) { wide -= 0x100000000; }
+	c->last_sequence = std::max(c->last_sequence, wide);
+	return wide;
+}
+
+static
+auto note_sequence(const xcb_generic_event_t& event) -> void {
+	const auto c = get_connection();
+	const auto sequence = widen_sequence(c, event.full_sequence);
+	c->processed = std::max(c->processed, sequence);
+	if (event.response_type == 0) {
+		// Unlike Xlib, XCB delivers errors for unchecked requests as
+		// events, and nothing else is done with them here.
+		const auto& e = reinterpret_cast<const xcb_generic_error_t&>(event);
+		record_x_error({sequence, e.error_code, e.major_code, static_cast<uint8_t>(e.minor_code)});
+	}
+}
+
+static
+auto handle_event(const xcb_generic_event_t& event) -> void {
+	note_sequence(event);
+	if (tracing_) {
+		trace_event(get_ref(get_window(event_window(event))), event.response_type & ~0x80);
+	}
+	// The top bit is set for events which came from SendEvent.
+	switch (event.response_type & ~0x80) {
+		case XCB_CONFIGURE_NOTIFY: {
+			const auto& e = reinterpret_cast<const xcb_configure_notify_event_t&>(event);
+			on_notify_configure(e.window, {e.x, e.y}, {e.width, e.height}, (event.response_type & 0x80) != 0);
+			break;
+		}
+		case XCB_REPARENT_NOTIFY: {
+			const auto& e = reinterpret_cast<const xcb_reparent_notify_event_t&>(event);
+			on_notify_reparent(e.window, e.parent == get_connection()->screen->root);
+			break;
+		}
+		case XCB_DESTROY_NOTIFY: {
+			const auto& e = reinterpret_cast<const xcb_destroy_notify_event_t&>(event);
+			on_notify_destroy(e.window);
+			break;
+		}
+		case XCB_EXPOSE: {
+			const auto& e = reinterpret_cast<const xcb_expose_event_t&>(event);
+			on_notify_expose(e.window, {e.x, e.y, e.width, e.height}, e.count);
+			break;
+		}
+		case XCB_MAPPING_NOTIFY: {
+			get_connection()->keysyms.clear();
+			break;
+		}
+		case XCB_CLIENT_MESSAGE: {
+			const auto& e = reinterpret_cast<const xcb_client_message_event_t&>(event);
+			const auto c = get_connection();
+			if (e.type != get_atom(*c, atom::wm_protocols) || e.format != 32) {
+				break;
+			}
+			const auto protocol = e.data.data32[0];
+			if (protocol == get_atom(*c, atom::wm_delete_window)) {
+				on_notify_destroy(e.window);
+			}
+			else if (protocol == get_atom(*c, atom::net_wm_sync_request)) {
+				const auto lo = static_cast<uint64_t>(e.data.data32[2]);
+				const auto hi = static_cast<uint64_t>(e.data.data32[3]);
+				on_sync_request(e.window, static_cast<int64_t>(lo | (hi << 32)));
+			}
+			break;
+		}
+		case XCB_MOTION_NOTIFY: {
+			const auto& e = reinterpret_cast<const xcb_motion_notify_event_t&>(event);
+			on_input_motion(e.event, {{e.event_x, e.event_y}, get_modifiers(e.state), make_input_time(e.time)});
+			break;
+		}
+		case XCB_BUTTON_PRESS:
+		case XCB_BUTTON_RELEASE: {
+			// Button press and release events have the same layout.
+			const auto& e = reinterpret_cast<const xcb_button_press_event_t&>(event);
+			const auto pressed = (event.response_type & ~0x80) == XCB_BUTTON_PRESS;
+			on_input_button(e.event, e.detail, pressed, {e.event_x, e.event_y}, get_modifiers(e.state), make_input_time(e.time));
+			break;
+		}
+		case XCB_KEY_PRESS:
+		case XCB_KEY_RELEASE: {
+			const auto& e = reinterpret_cast<const xcb_key_press_event_t&>(event);
+			const auto pressed = (event.response_type & ~0x80) == XCB_KEY_PRESS;
+			on_input_key(e.event, {e.detail, get_keysym(e.detail), pressed, get_modifiers(e.state), make_input_time(e.time)});
+			break;
+		}
+		default: {
+			if (is_randr_event(event)) {
+				on_notify_screen_change();
+			}
+			break;
+		}
+	}
+}
+
+auto process_messages() -> void {
+	const auto c = get_connection();
+	if (!c) {
+		return;
+	}
+	const auto scope = traced{trace_scope::dispatch};
+	const auto was_dispatching = dispatch_beg();
+	// XCB can't leave some events in the queue and take others, so with
+	// a shared connection the host hands ours over through dispatch().
+	if (!c->shared) {
+		if (const auto event = std::exchange(stashed_event_, nullptr)) {
+			handle_event(*event);
+			std::free(event);
+		}
+		while (const auto event = xcb_poll_for_event(c->xcb)) {
+			handle_event(*event);
+			std::free(event);
+		}
+	}
+	else {
+		xcb_flush(c->xcb);
+	}
+	dispatch_end(was_dispatching);
+}
+
+auto dispatch(const xcb_generic_event_t& event) -> bool {
+	note_sequence(event);
+	if (event.response_type == 0) {
+		// The error may be for one of the host's requests, so it gets
+		// to see it too.
+		return false;
+	}
+	if ((event.response_type & ~0x80) == XCB_MAPPING_NOTIFY) {
+		// The host needs to see this too.
+		handle_event(event);
+		return false;
+	}
+	if (is_randr_event(event)) {
+		// Selected on the root window, so it's the host's too.
+		on_notify_screen_change();
+		return false;
+	}
+	if (!get_window(event_window(event))) {
+		return false;
+	}
+	const auto scope = traced{trace_scope::dispatch};
+	const auto was_dispatching = dispatch_beg();
+	handle_event(event);
+	dispatch_end(was_dispatching);
+	return true;
+}
+
+// XCB doesn't say what the sequence number of the next request will be,
+// but a NoOperation request costs four bytes and no round trip. It goes
+// out with the requests being marked.
+auto mark_x_errors() -> x_error_mark {
+	const auto c = get_connection();
+	if (!c) {
+		return {};
+	}
+	return {widen_sequence(c, xcb_no_operation(c->xcb).sequence) + 1};
+}
+
+// A GetInputFocus is sent for the first check after the mark, and the
+// requests before it are known to be processed once its reply arrives.
+// Later checks wait on the same one instead of sending more. With a
+// shared connection the reply is left to the host, since reading here
+// would take its events, so the answer only moves on with the events it
+// passes to dispatch().
+auto check_x_errors(x_error_mark since, x_error* first) -> x_error_status {
+	const auto c = get_connection();
+	if (!c) {
+		return x_error_status::none;
+	}
+	if (c->probe.sequence && !c->shared) {
+		xcb_get_input_focus_reply_t* reply = nullptr;
+		xcb_generic_error_t* error = nullptr;
+		if (xcb_poll_for_reply(c->xcb, c->probe.sequence, reinterpret_cast<void**>(&reply), &error)) {
+			std::free(reply);
+			std::free(error);
+			c->processed = std::max(c->processed, c->probe_sequence);
+			c->probe = {};
+		}
+	}
+	if (c->probe_sequence == 0 || c->probe_sequence < since.serial) {
+		if (c->probe.sequence) {
+			xcb_discard_reply(c->xcb, c->probe.sequence);
+		}
+		c->probe = xcb_get_input_focus(c->xcb);
+		c->probe_sequence = widen_sequence(c, c->probe.sequence);
+		if (c->shared) {
+			xcb_discard_reply(c->xcb, c->probe.sequence);
+			c->probe = {};
+		}
+		xcb_flush(c->xcb);
+	}
+	return check_x_errors(since, c->probe_sequence - 1, c->processed, first);
+}
+
+auto resize_done(window* ref) -> void {
+	const auto wnd = get_window(ref);
+	if (!wnd) { return; }
+	ack_sync(wnd);
+	xcb_flush(get_connection()->xcb);
+}
+
+static
+auto get_connection_fd() -> int {
+	const auto c = get_connection();
+	return c ? xcb_get_file_descriptor(c->xcb) : -1;
+}
+
+static
+auto prepare_wait() -> bool {
+	const auto c = get_connection();
+	xcb_flush(c->xcb);
+	if (c->shared) {
+		// Whatever is queued is the host's business.
+		return false;
+	}
+	// Events can be read into XCB's queue while it waits for a reply,
+	// in which case the fd won't become readable for them.
+	if (!stashed_event_) {
+		stashed_event_ = xcb_poll_for_queued_event(c->xcb);
+	}
+	return stashed_event_ != nullptr;
+}
+
+auto app_beg(edwin::fn::frame frame, edwin::frame_interval interval, edwin::frame_overrun overrun) -> void {
+	run_app(std::move(frame), interval, overrun);
+}
+
+auto app_end() -> void {
+	app_schedule_stop_ = true;
+}
+
+} // edwin